@@ -0,0 +1,199 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "wingblockmetadata.h"
+
+#include <limits>
+
+using namespace KSyntaxHighlighting;
+
+WingBlockMetadata::WingBlockMetadata() {
+    m_slots.resize(1);
+    m_symbols.append(QString());
+}
+
+void WingBlockMetadata::reset(int blockCount) {
+    m_flags.fill(0, blockCount);
+    m_stateIds.fill(0, blockCount);
+    m_slotIds.fill(0, blockCount);
+    m_symbolIds.fill(0, blockCount);
+    m_indents.fill(-1, blockCount);
+
+    m_slots.resize(1);
+    m_freeSlots.clear();
+}
+
+int WingBlockMetadata::size() const { return m_flags.size(); }
+
+void WingBlockMetadata::blocksChanged(int block, int removed, int added) {
+    const int at = qBound(0, block + 1, size());
+    const int count = qBound(0, removed, size() - at);
+    if (count > 0) {
+        for (int i = at; i < at + count; ++i) {
+            releaseSlot(i);
+        }
+        m_flags.remove(at, count);
+        m_stateIds.remove(at, count);
+        m_slotIds.remove(at, count);
+        m_symbolIds.remove(at, count);
+        m_indents.remove(at, count);
+    }
+    if (added > 0) {
+        m_flags.insert(at, added, 0);
+        m_stateIds.insert(at, added, 0);
+        m_slotIds.insert(at, added, 0);
+        m_symbolIds.insert(at, added, 0);
+        m_indents.insert(at, added, -1);
+    }
+}
+
+WingBlockMetadata::Flags WingBlockMetadata::flags(int block) const {
+    return contains(block) ? Flags(m_flags.at(block)) : Flags();
+}
+
+void WingBlockMetadata::setFlag(int block, Flag flag, bool on) {
+    if (contains(block)) {
+        m_flags[block] = on ? (m_flags.at(block) | flag)
+                            : (m_flags.at(block) & ~quint8(flag));
+    }
+}
+
+bool WingBlockMetadata::testFlag(int block, Flag flag) const {
+    return contains(block) && (m_flags.at(block) & flag);
+}
+
+int WingBlockMetadata::stateId(int block) const {
+    return contains(block) ? m_stateIds.at(block) : 0;
+}
+
+void WingBlockMetadata::setStateId(int block, int id) {
+    if (contains(block)) {
+        m_stateIds[block] = id;
+    }
+}
+
+const QList<WingFormatRun> &WingBlockMetadata::formatRuns(int block) const {
+    return m_slots.at(contains(block) ? m_slotIds.at(block) : 0).runs;
+}
+
+void WingBlockMetadata::setFormatRuns(int block,
+                                      const QList<WingFormatRun> &runs) {
+    if (!contains(block) || (runs.isEmpty() && !m_slotIds.at(block))) {
+        return;
+    }
+    slot(block).runs = runs;
+}
+
+const QList<FoldingRegion> &WingBlockMetadata::foldingRegions(int block) const {
+    return m_slots.at(contains(block) ? m_slotIds.at(block) : 0)
+        .foldingRegions;
+}
+
+bool WingBlockMetadata::setFoldingRegions(int block,
+                                          const QList<FoldingRegion> &regions) {
+    if (!contains(block) || foldingRegions(block) == regions) {
+        return false;
+    }
+
+    bool begins = false;
+    bool ends = false;
+    for (const auto &region : regions) {
+        begins |= region.type() == FoldingRegion::Begin;
+        ends |= region.type() == FoldingRegion::End;
+    }
+    setFlag(block, FoldBegin, begins);
+    setFlag(block, FoldEnd, ends);
+
+    if (!regions.isEmpty() || m_slotIds.at(block)) {
+        slot(block).foldingRegions = regions;
+    }
+    return true;
+}
+
+QString WingBlockMetadata::symbol(int block) const {
+    return contains(block) ? m_symbols.at(m_symbolIds.at(block)) : QString();
+}
+
+void WingBlockMetadata::setSymbol(int block, const QString &id) {
+    if (!contains(block)) {
+        return;
+    }
+    if (id.isEmpty()) {
+        m_symbolIds[block] = 0;
+        return;
+    }
+
+    auto it = m_symbolLookup.constFind(id);
+    if (it == m_symbolLookup.constEnd()) {
+        it = m_symbolLookup.insert(id, m_symbols.size());
+        m_symbols.append(id);
+    }
+    m_symbolIds[block] = it.value();
+}
+
+int WingBlockMetadata::indent(int block) const {
+    return contains(block) ? m_indents.at(block) : -1;
+}
+
+bool WingBlockMetadata::setIndent(int block, int indent) {
+    if (!contains(block)) {
+        return false;
+    }
+    const auto value =
+        qint16(qMin(indent, int(std::numeric_limits<qint16>::max())));
+    if (m_indents.at(block) == value) {
+        return false;
+    }
+    m_indents[block] = value;
+    return true;
+}
+
+bool WingBlockMetadata::isBlank(int block) const {
+    return testFlag(block, Blank);
+}
+
+bool WingBlockMetadata::setBlank(int block, bool blank) {
+    if (!contains(block) || isBlank(block) == blank) {
+        return false;
+    }
+    setFlag(block, Blank, blank);
+    return true;
+}
+
+bool WingBlockMetadata::contains(int block) const {
+    return block >= 0 && block < size();
+}
+
+WingBlockMetadata::Slot &WingBlockMetadata::slot(int block) {
+    auto &id = m_slotIds[block];
+    if (!id) {
+        if (m_freeSlots.isEmpty()) {
+            id = m_slots.size();
+            m_slots.append(Slot());
+        } else {
+            id = m_freeSlots.takeLast();
+        }
+    }
+    return m_slots[id];
+}
+
+void WingBlockMetadata::releaseSlot(int block) {
+    auto &id = m_slotIds[block];
+    if (id) {
+        m_slots[id] = Slot();
+        m_freeSlots.append(id);
+        id = 0;
+    }
+}
@@ -0,0 +1,127 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGBLOCKMETADATA_H
+#define WINGBLOCKMETADATA_H
+
+#include <KSyntaxHighlighting/FoldingRegion>
+
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QVector>
+
+/** A highlighted range of a block, styled by the definition format with
+ *  @c formatId */
+struct WingFormatRun {
+    /** formatId of the whitespace spans laid over the tokens */
+    static constexpr int WhitespaceFormat = -1;
+
+    int offset;
+    int length;
+    int formatId;
+};
+
+/**
+ * Per-block metadata of a highlighted document, kept in columns indexed
+ * by block number instead of a QTextBlockUserData object per block.
+ * Format runs and folding regions live in a slot pool, so inserting or
+ * removing blocks only moves a few bytes per block.
+ */
+class WingBlockMetadata {
+public:
+    enum Flag : quint8 {
+        Highlighted = 0x01,
+        /** the block used formats from outside the definition */
+        CustomFormats = 0x02,
+        /** the block exceeded the line budget and was left unhighlighted */
+        Plain = 0x04,
+        /** summary of the folding regions left open or closed */
+        FoldBegin = 0x08,
+        FoldEnd = 0x10,
+        /** empty or matching the folding ignore list of the definition */
+        Blank = 0x20,
+    };
+    Q_DECLARE_FLAGS(Flags, Flag)
+
+public:
+    WingBlockMetadata();
+
+public:
+    void reset(int blockCount);
+    int size() const;
+
+    /** Keeps the columns in sync after the @p removed blocks right after
+     *  @p block were replaced with @p added new ones.
+     */
+    void blocksChanged(int block, int removed, int added);
+
+    Flags flags(int block) const;
+    void setFlag(int block, Flag flag, bool on = true);
+    bool testFlag(int block, Flag flag) const;
+
+    int stateId(int block) const;
+    void setStateId(int block, int id);
+
+    const QList<WingFormatRun> &formatRuns(int block) const;
+    void setFormatRuns(int block, const QList<WingFormatRun> &runs);
+
+    const QList<KSyntaxHighlighting::FoldingRegion> &
+    foldingRegions(int block) const;
+    /** Returns whether the folding regions of @p block changed */
+    bool setFoldingRegions(
+        int block, const QList<KSyntaxHighlighting::FoldingRegion> &regions);
+
+    QString symbol(int block) const;
+    void setSymbol(int block, const QString &id);
+
+    /** Leading indentation in columns, -1 if not known yet */
+    int indent(int block) const;
+    /** Returns whether the indentation of @p block changed */
+    bool setIndent(int block, int indent);
+
+    bool isBlank(int block) const;
+    /** Returns whether @p block became blank or stopped being blank */
+    bool setBlank(int block, bool blank);
+
+private:
+    struct Slot {
+        QList<WingFormatRun> runs;
+        QList<KSyntaxHighlighting::FoldingRegion> foldingRegions;
+    };
+
+    bool contains(int block) const;
+    Slot &slot(int block);
+    void releaseSlot(int block);
+
+private:
+    QVector<quint8> m_flags;
+    QVector<qint32> m_stateIds;
+    QVector<qint32> m_slotIds;
+    QVector<qint32> m_symbolIds;
+    QVector<qint16> m_indents;
+
+    // slot 0 is the shared empty slot
+    QVector<Slot> m_slots;
+    QVector<qint32> m_freeSlots;
+
+    // symbol 0 is no symbol
+    QStringList m_symbols;
+    QHash<QString, qint32> m_symbolLookup;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(WingBlockMetadata::Flags)
+
+#endif // WINGBLOCKMETADATA_H
@@ -17,13 +17,17 @@
 #include "wingcompleter.h"
 #include "winglinemargin.h"
 #include "wingsymbolcenter.h"
+#include "wingeditorstatecache.h"
+#include "winghighlightworker.h"
 #include "wingsyntaxhighlighter.h"
 
 #include <QAbstractItemView>
 #include <QApplication>
 #include <QEvent>
+#include <QFutureWatcher>
 #include <QMimeData>
 #include <QPainter>
+#include <QPointer>
 #include <QPalette>
 #include <QPrinter>
 #include <QRegularExpression>
@@ -31,9 +35,11 @@
 #include <QStack>
 #include <QStyle>
 #include <QStyleHints>
-#include <QTimer>
 #include <QToolTip>
+#include <QThread>
+#include <QTimer>
 #include <QUndoStack>
+#include <QtConcurrent>
 #include <QtMath>
 
 #include <KSyntaxHighlighting/Repository>
@@ -50,26 +56,68 @@ WingCodeEdit::WingCodeEdit(QWidget *parent)
 
     m_highlighter = new WingSyntaxHighlighter(document());
     m_highlighter->setTabWidth(m_tabCharSize);
+    m_highlighter->setHighlightMode(
+        WingSyntaxHighlighter::HighlightMode::Background);
+    updateHighlightPriority();
 
     m_sighlp = new WingSignatureTooltip(this);
 
+    m_liveSearchWatcher = new QFutureWatcher<WingTextSearch::Batch>(this);
+    connect(m_liveSearchWatcher, &QFutureWatcherBase::resultsReadyAt, this,
+            &WingCodeEdit::updateLiveSearchResults);
+    m_liveSearchTimer = new QTimer(this);
+    m_liveSearchTimer->setSingleShot(true);
+    m_liveSearchTimer->setInterval(200);
+    connect(m_liveSearchTimer, &QTimer::timeout, this,
+            &WingCodeEdit::updateLiveSearch);
+    m_searchWatcher = new QFutureWatcher<WingTextSearch::Batch>(this);
+    connect(m_searchWatcher, &QFutureWatcherBase::resultsReadyAt, this,
+            [this](int begin, int end) {
+                QList<QTextCursor> matches;
+                QTextCursor cursor(document());
+                for (int i = begin; i < end; ++i) {
+                    for (const auto &match : m_searchWatcher->resultAt(i)) {
+                        cursor.setPosition(match.position);
+                        cursor.setPosition(match.position + match.length,
+                                           QTextCursor::KeepAnchor);
+                        matches.append(cursor);
+                    }
+                }
+                emit searchResultsReady(matches);
+            });
+    connect(m_searchWatcher, &QFutureWatcherBase::finished, this,
+            &WingCodeEdit::searchFinished);
+
     connect(this, &QPlainTextEdit::blockCountChanged, this,
             &WingCodeEdit::updateMargins);
     connect(this, &QPlainTextEdit::updateRequest, this,
             &WingCodeEdit::updateLineNumbers);
     connect(this, &QPlainTextEdit::cursorPositionChanged, this,
             &WingCodeEdit::updateCursor);
-    connect(this, &QPlainTextEdit::textChanged, this,
-            &WingCodeEdit::updateLiveSearch);
+    connect(document(), &QTextDocument::contentsChange, this,
+            &WingCodeEdit::updateContents);
     connect(this, &QPlainTextEdit::selectionChanged, this,
             &WingCodeEdit::highlightOccurrences);
+    connect(this, &QPlainTextEdit::blockCountChanged, this,
+            &WingCodeEdit::updateHighlightViewport);
+    connect(verticalScrollBar(), &QScrollBar::valueChanged, this,
+            &WingCodeEdit::updateHighlightViewport);
 
     // Initialize default editor configuration
     QFont fixedFont = QFontDatabase::systemFont(QFontDatabase::FixedFont);
     setDefaultFont(fixedFont);
     setWordWrap(false);
     setIndentationMode(IndentationMode::IndentSpaces);
-    setDefaultTheme();
+    if (syntaxRepoFuture().isValid() && !isSyntaxRepoReady()) {
+        whenSyntaxRepoReady(this, [this](KSyntaxHighlighting::Repository *) {
+            // unless a theme was set in the meantime
+            if (!m_highlighter->theme().isValid()) {
+                setDefaultTheme();
+            }
+        });
+    } else {
+        setDefaultTheme();
+    }
 
     QTextOption opt = document()->defaultTextOption();
     opt.setFlags(opt.flags() |
@@ -484,86 +532,273 @@ bool WingCodeEdit::isCurrentLineFolded() const {
     return block.isValid() && WingSyntaxHighlighter::isFolded(block);
 }
 
-template <typename Findable>
-QTextCursor safeFindNext(QTextDocument *document, const Findable &search,
-                         const QTextCursor &start,
-                         QTextDocument::FindFlags flags, bool matchFirst) {
-    // If a search returns the same starting cursor, we need to skip over it
-    // to find the next match (which could be equal to the skipped cursor).
-    // Otherwise, certain types of searches could result in an infinite loop.
-
-    QTextCursor cursor = document->find(search, start, flags);
-    if (cursor == start && !matchFirst) {
-        if (cursor.atEnd())
-            return QTextCursor();
-        cursor.movePosition(QTextCursor::NextCharacter);
-        cursor = document->find(search, cursor, flags);
-    }
-    return cursor;
-}
-
 QTextCursor WingCodeEdit::textSearch(const QTextCursor &start,
                                      const SearchParams &params,
                                      bool matchFirst, bool reverse,
                                      QRegularExpressionMatch *regexMatch) {
-    QTextDocument::FindFlags flags;
-    if (params.caseSensitive)
-        flags |= QTextDocument::FindCaseSensitively;
-    if (params.wholeWord)
-        flags |= QTextDocument::FindWholeWords;
-    if (reverse)
-        flags |= QTextDocument::FindBackward;
-
-    if (params.regex) {
-        QRegularExpression::PatternOptions csOption =
-            params.caseSensitive ? QRegularExpression::NoPatternOption
-                                 : QRegularExpression::CaseInsensitiveOption;
-        const QRegularExpression re(params.searchText, csOption);
-        QTextCursor cursor =
-            safeFindNext(document(), re, start, flags, matchFirst);
-        if (cursor.isNull())
-            return cursor;
+    // kept for source compatibility, empty matches at the start are
+    // stepped past below
+    Q_UNUSED(matchFirst);
+
+    const auto search = compileSearch(params);
+    if (search.isEmpty())
+        return QTextCursor();
+
+    // like QTextDocument::find(), forwards from the end of the selection
+    // and backwards from before its start
+    auto doc = document();
+    int pos = 0;
+    if (!start.isNull())
+        pos = reverse ? start.selectionStart() - 1 : start.selectionEnd();
+    if (pos < 0)
+        return QTextCursor();
+
+    // an empty match at an empty start cursor would be found over and
+    // over, step past it like QTextDocument::find() callers have to
+    const bool skipEmptyAtStart =
+        !reverse && !start.isNull() && !start.hasSelection();
+    const auto skipped = [&](int matchPos, int matchLength) {
+        return skipEmptyAtStart && matchLength == 0 && matchPos == pos;
+    };
+
+    WingTextSearch::Match match;
+    if (search.isMultiLine()) {
+        const auto &text = searchSnapshot();
+        bool found = false;
+        if (reverse) {
+            // in doubling windows back from pos instead of through every
+            // match from the start of the document
+            qsizetype size = 1 << 16;
+            for (int end = pos; end >= 0 && !found; size *= 2) {
+                const int begin = int(qMax<qsizetype>(0, end - size + 1));
+                found = search.findPrevious(text, end, match, begin);
+                end = begin - 1;
+            }
+        } else {
+            found = search.findNext(text, pos, match);
+        }
+        if (found && skipped(match.offset, match.length))
+            found = search.findNext(text, pos + 1, match);
+        if (!found)
+            return QTextCursor();
         if (regexMatch)
-            *regexMatch = re.match(cursor.selectedText());
+            *regexMatch = search.regexMatch(text, match);
+        QTextCursor cursor(doc);
+        cursor.setPosition(match.offset);
+        cursor.setPosition(match.offset + match.length,
+                           QTextCursor::KeepAnchor);
         return cursor;
-    } else {
-        return safeFindNext(document(), params.searchText, start, flags,
-                            matchFirst);
     }
+
+    QTextBlock block = doc->findBlock(pos);
+    int from = pos - block.position();
+    QString text;
+    bool found = false;
+    while (block.isValid()) {
+        text = block.text();
+        if (reverse) {
+            found = search.findPrevious(text, from, match);
+        } else {
+            found = search.findNext(text, from, match);
+            if (found && skipped(block.position() + match.offset,
+                                 match.length))
+                found = search.findNext(text, from + 1, match);
+        }
+        if (found)
+            break;
+        block = reverse ? block.previous() : block.next();
+        from = reverse ? block.length() - 2 : 0;
+    }
+    if (!found)
+        return QTextCursor();
+    if (regexMatch)
+        *regexMatch = search.regexMatch(text, match);
+
+    QTextCursor cursor(doc);
+    cursor.setPosition(block.position() + match.offset);
+    cursor.setPosition(block.position() + match.offset + match.length,
+                       QTextCursor::KeepAnchor);
+    return cursor;
+}
+
+WingTextSearch WingCodeEdit::compileSearch(const SearchParams &params) {
+    return m_searchCache.search(params.searchText, params.caseSensitive,
+                                params.wholeWord, params.regex,
+                                params.multiLine);
+}
+
+const QString &WingCodeEdit::searchSnapshot() {
+    if (!m_searchSnapshotValid) {
+        m_searchSnapshot = document()->toPlainText();
+        m_searchSnapshotValid = true;
+    }
+    return m_searchSnapshot;
 }
 
 void WingCodeEdit::setLiveSearch(const SearchParams &params) {
-    m_liveSearch = params;
-    updateLiveSearch();
+    const auto search = compileSearch(params);
+    // an unfinished background search has no complete results to refine
+    const bool refine =
+        search.refines(m_liveSearch) && !m_liveSearchWatcher->isRunning();
+    m_liveSearch = search;
+    if (refine)
+        refineLiveSearch();
+    else
+        updateLiveSearch();
 }
 
 void WingCodeEdit::clearLiveSearch() {
-    m_liveSearch.searchText = QString();
+    m_liveSearch = WingTextSearch();
     updateLiveSearch();
 }
 
+void WingCodeEdit::startSearch(const SearchParams &params) {
+    const auto search = compileSearch(params);
+    m_searchWatcher->cancel();
+    m_searchWatcher->setFuture(search.run(document()->toPlainText()));
+}
+
+void WingCodeEdit::cancelSearch() { m_searchWatcher->cancel(); }
+
+bool WingCodeEdit::isSearching() const {
+    return m_searchWatcher->isRunning();
+}
+
 void WingCodeEdit::updateLiveSearch() {
-    if (m_searchResults.isEmpty() && m_liveSearch.searchText.isEmpty())
+    m_liveSearchTimer->stop();
+    m_liveSearchWatcher->cancel();
+    if (m_searchResults.isEmpty() && m_liveSearch.isEmpty())
         return;
 
     m_searchResults.clear();
-    if (!m_liveSearch.searchText.isEmpty()) {
-        auto searchCursor = textCursor();
-        searchCursor.movePosition(QTextCursor::Start);
-        searchCursor = textSearch(searchCursor, m_liveSearch, true);
-        while (!searchCursor.isNull()) {
-            if (searchCursor.hasSelection()) {
-                QTextEdit::ExtraSelection selection;
-                selection.format.setBackground(m_searchBg);
-                selection.cursor = searchCursor;
-                m_searchResults.append(selection);
-            }
-            searchCursor = textSearch(searchCursor, m_liveSearch, false);
+    // a multi-line search scans the text as a whole, off the GUI thread
+    if (m_liveSearch.isMultiLine() ||
+        document()->characterCount() > AsyncSearchThreshold) {
+        if (!m_liveSearch.isEmpty()) {
+            m_liveSearchWatcher->setFuture(
+                m_liveSearch.run(document()->toPlainText()));
         }
+    } else {
+        matchLiveSearch(document()->begin(), document()->lastBlock(),
+                        m_searchResults);
     }
     updateExtraSelections();
 }
 
+void WingCodeEdit::updateLiveSearchResults(int begin, int end) {
+    QTextEdit::ExtraSelection selection;
+    selection.format.setBackground(m_searchBg);
+    selection.cursor = QTextCursor(document());
+    for (int i = begin; i < end; ++i) {
+        for (const auto &match : m_liveSearchWatcher->resultAt(i)) {
+            selection.cursor.setPosition(match.position);
+            selection.cursor.setPosition(match.position + match.length,
+                                         QTextCursor::KeepAnchor);
+            m_searchResults.append(selection);
+        }
+    }
+    updateExtraSelections();
+}
+
+void WingCodeEdit::refineLiveSearch() {
+    // only the lines matched by the previous query can match
+    QList<QTextEdit::ExtraSelection> results;
+    int lastBlock = -1;
+    for (const auto &result : std::as_const(m_searchResults)) {
+        const QTextBlock block = result.cursor.block();
+        if (block.blockNumber() != lastBlock) {
+            lastBlock = block.blockNumber();
+            matchLiveSearch(block, block, results);
+        }
+    }
+    m_searchResults = std::move(results);
+    updateExtraSelections();
+}
+
+void WingCodeEdit::updateContents(int position, int charsRemoved,
+                                  int charsAdded) {
+    // restyled blocks are reported as replaced by themselves, without a
+    // new revision
+    auto doc = document();
+    const int revision = doc->revision();
+    if (charsRemoved == charsAdded && revision == m_contentsRevision &&
+        doc->isUndoRedoEnabled())
+        return;
+    m_contentsRevision = revision;
+
+    // the snapshot being searched is out of date
+    m_searchSnapshot.clear();
+    m_searchSnapshotValid = false;
+    cancelSearch();
+    if (m_liveSearchTimer->isActive() || m_liveSearchWatcher->isRunning() ||
+        m_liveSearch.isMultiLine()) {
+        m_liveSearchWatcher->cancel();
+        m_liveSearchTimer->start();
+    } else {
+        updateLiveSearchRange(position, charsAdded);
+    }
+}
+
+void WingCodeEdit::updateLiveSearchRange(int position, int charsAdded) {
+    if (m_liveSearch.isEmpty())
+        return;
+
+    auto doc = document();
+    const QTextBlock first = doc->findBlock(position);
+    QTextBlock last = doc->findBlock(position + charsAdded);
+    if (!last.isValid())
+        last = doc->lastBlock();
+    const int from = first.position();
+    const int to = last.position() + last.length();
+
+    // the cursors of all other matches already moved along with the text
+    const auto begin = std::lower_bound(
+        m_searchResults.begin(), m_searchResults.end(), from,
+        [](const QTextEdit::ExtraSelection &result, int pos) {
+            return result.cursor.selectionEnd() < pos;
+        });
+    auto end = begin;
+    while (end != m_searchResults.end() && end->cursor.selectionStart() < to)
+        ++end;
+
+    QList<QTextEdit::ExtraSelection> matches;
+    matchLiveSearch(first, last, matches);
+    if (begin == end && matches.isEmpty())
+        return;
+
+    auto index = begin - m_searchResults.begin();
+    m_searchResults.erase(begin, end);
+    for (auto &match : matches)
+        m_searchResults.insert(index++, std::move(match));
+    updateExtraSelections();
+}
+
+void WingCodeEdit::matchLiveSearch(
+    QTextBlock block, const QTextBlock &lastBlock,
+    QList<QTextEdit::ExtraSelection> &results) const {
+    if (m_liveSearch.isEmpty())
+        return;
+
+    QList<WingTextSearch::Match> matches;
+    QTextEdit::ExtraSelection selection;
+    selection.format.setBackground(m_searchBg);
+    selection.cursor = QTextCursor(document());
+    for (; block.isValid(); block = block.next()) {
+        matches.clear();
+        m_liveSearch.matchLine(block.text(), matches);
+        const int position = block.position();
+        for (const auto &match : std::as_const(matches)) {
+            selection.cursor.setPosition(position + match.offset);
+            selection.cursor.setPosition(position + match.offset +
+                                             match.length,
+                                         QTextCursor::KeepAnchor);
+            results.append(selection);
+        }
+        if (block == lastBlock)
+            break;
+    }
+}
+
 void WingCodeEdit::updateExtraSelections() {
     QPlainTextEdit::setExtraSelections(
         m_extraSelections + m_braceMatch + m_searchResults +
@@ -574,16 +809,89 @@ void WingCodeEdit::updateExtraSelections() {
 void WingCodeEdit::setHighlighter(WingSyntaxHighlighter *newHighlighter) {
     if (newHighlighter) {
         newHighlighter->setTabWidth(m_highlighter->tabWidth());
+        newHighlighter->setHighlightMode(m_highlighter->highlightMode());
+        newHighlighter->setAsyncThreshold(m_highlighter->asyncThreshold());
+        newHighlighter->setTimeSlice(m_highlighter->timeSlice());
+        newHighlighter->setLookAhead(m_highlighter->lookAhead());
+        newHighlighter->setLineCacheSize(m_highlighter->lineCacheSize());
+        newHighlighter->setMaxLineLength(m_highlighter->maxLineLength());
+        newHighlighter->setLineTimeBudget(m_highlighter->lineTimeBudget());
+        newHighlighter->setPriority(m_highlighter->priority());
+        newHighlighter->setBackendEnabled(m_highlighter->isBackendEnabled());
         newHighlighter->setDefinition(m_highlighter->definition());
         newHighlighter->setTheme(m_highlighter->theme());
         m_highlighter->setDocument(nullptr);
         m_highlighter->deleteLater();
         newHighlighter->setDocument(document());
         m_highlighter = newHighlighter;
+        updateHighlightViewport();
         m_highlighter->rehighlight();
     }
 }
 
+bool WingCodeEdit::saveEditorState(int checkpointInterval) const {
+    WingEditorState state;
+    state.syntax = m_highlighter->definition().name();
+    state.checkpoints = m_highlighter->stateCheckpoints(checkpointInterval);
+
+    for (auto block = document()->begin(); block.isValid();
+         block = block.next()) {
+        const auto id = m_highlighter->symbolMarkID(block);
+        if (!id.isEmpty()) {
+            state.symbolMarks.append({block.blockNumber() + 1, id});
+        }
+    }
+
+    // every fold with its own range, nested ones inside hidden text too
+    const auto doc = document();
+    const auto ranges = m_highlighter->foldRanges();
+    for (const auto &range : ranges) {
+        if (WingSyntaxHighlighter::isFolded(
+                doc->findBlockByNumber(range.begin))) {
+            state.folds.append({range.begin, range.last});
+        }
+    }
+
+    state.cursorPosition = textCursor().position();
+    state.scrollPosition = verticalScrollBar()->value();
+    return WingEditorStateCache::save(
+        WingEditorStateCache::contentKey(document()), state);
+}
+
+bool WingCodeEdit::restoreEditorState() {
+    WingEditorState state;
+    if (!WingEditorStateCache::load(
+            WingEditorStateCache::contentKey(document()), state)) {
+        return false;
+    }
+
+    auto doc = document();
+    if (state.syntax == m_highlighter->definition().name()) {
+        m_highlighter->setStateCheckpoints(state.checkpoints);
+    }
+
+    // the hidden ranges are stored, so no fold region has to be searched
+    if (!state.folds.isEmpty()) {
+        m_highlighter->setFoldedRanges(state.folds);
+    }
+
+    for (const auto &mark : std::as_const(state.symbolMarks)) {
+        addSymbolMark(mark.first, mark.second);
+    }
+
+    auto cursor = textCursor();
+    cursor.setPosition(qBound(0, state.cursorPosition,
+                              doc->characterCount() - 1));
+    setTextCursor(cursor);
+
+    if (!state.folds.isEmpty()) {
+        updateScrollBars();
+    }
+    verticalScrollBar()->setValue(state.scrollPosition);
+    updateHighlightViewport();
+    return true;
+}
+
 QList<QTextEdit::ExtraSelection> WingCodeEdit::extraSelections() const {
     return m_extraSelections;
 }
@@ -641,9 +949,68 @@ bool WingCodeEdit::matchBraces() const {
     return m_config.testFlag(WingCodeEditConfig::MatchBraces);
 }
 
+QFuture<KSyntaxHighlighting::Repository *> &WingCodeEdit::syntaxRepoFuture() {
+    static QFuture<KSyntaxHighlighting::Repository *> s_syntaxRepoFuture;
+    return s_syntaxRepoFuture;
+}
+
+using SyntaxRepoWaiter =
+    std::pair<QPointer<QObject>,
+              std::function<void(KSyntaxHighlighting::Repository *)>>;
+
+static QList<SyntaxRepoWaiter> &syntaxRepoWaiters() {
+    static QList<SyntaxRepoWaiter> s_waiters;
+    return s_waiters;
+}
+
+void WingCodeEdit::whenSyntaxRepoReady(
+    QObject *context,
+    const std::function<void(KSyntaxHighlighting::Repository *)> &callback) {
+    preloadSyntaxRepo();
+    if (isSyntaxRepoReady()) {
+        callback(syntaxRepoFuture().result());
+        return;
+    }
+    syntaxRepoWaiters().append({context, callback});
+}
+
 KSyntaxHighlighting::Repository &WingCodeEdit::syntaxRepo() {
-    static KSyntaxHighlighting::Repository s_syntaxRepo;
-    return s_syntaxRepo;
+    preloadSyntaxRepo();
+    static const std::unique_ptr<KSyntaxHighlighting::Repository> s_syntaxRepo(
+        syntaxRepoFuture().result());
+    return *s_syntaxRepo;
+}
+
+void WingCodeEdit::preloadSyntaxRepo() {
+    auto &future = syntaxRepoFuture();
+    if (future.isValid()) {
+        return;
+    }
+
+    // the repository only reads the definition index and the themes here,
+    // the definitions themselves are parsed when they are first used
+    const auto thread = QThread::currentThread();
+    future = QtConcurrent::run([thread]() {
+        auto repo = new KSyntaxHighlighting::Repository;
+        repo->moveToThread(thread);
+        return repo;
+    });
+
+    // the only continuation of the future, it notifies every waiter
+    future.then(QCoreApplication::instance(),
+                [](KSyntaxHighlighting::Repository *repo) {
+                    const auto waiters = std::exchange(syntaxRepoWaiters(), {});
+                    for (const auto &[context, callback] : waiters) {
+                        if (context) {
+                            callback(repo);
+                        }
+                    }
+                });
+}
+
+bool WingCodeEdit::isSyntaxRepoReady() {
+    const auto &future = syntaxRepoFuture();
+    return future.isValid() && future.isFinished();
 }
 
 const KSyntaxHighlighting::Definition &WingCodeEdit::nullSyntax() {
@@ -726,20 +1093,14 @@ void WingCodeEdit::setTheme(const KSyntaxHighlighting::Theme &theme) {
     m_warnFg = theme.textColor(KSyntaxHighlighting::Theme::Warning);
     m_infoFg = theme.textColor(KSyntaxHighlighting::Theme::Information);
 
+    // restyles the existing format runs, the text is not highlighted again
     m_highlighter->setTheme(theme);
-    m_highlighter->rehighlight();
 
     // Update extra highlights to match the new theme
-    for (auto &result : m_searchResults)
-        result.format.setBackground(m_searchBg);
+    restyleExtraSelections();
     updateTextMetrics();
     updateCursor();
 
-    QTimer::singleShot(100, this, [this]() {
-        highlightAllSquiggle();
-        highlightOccurrences();
-    });
-
     emit themeChanged();
 }
 
@@ -763,9 +1124,32 @@ void WingCodeEdit::setDefaultTheme() {
 }
 
 void WingCodeEdit::setSyntax(const KSyntaxHighlighting::Definition &syntax) {
+    ++m_syntaxRequest;
     m_highlighter->setDefinition(syntax);
 }
 
+void WingCodeEdit::setSyntaxAsync(const QString &name) {
+    preloadSyntaxRepo();
+
+    const int request = ++m_syntaxRequest;
+    whenSyntaxRepoReady(this, [this, name, request](
+                                  KSyntaxHighlighting::Repository *repo) {
+        if (request != m_syntaxRequest) {
+            return;
+        }
+        // parse the definition and everything it includes on the thread
+        // pool, not on the first highlighted block
+        QtConcurrent::run([repo, name]() {
+            return WingHighlightWorker::loadDefinition(repo, name);
+        }).then(this, [this, request](
+                          const KSyntaxHighlighting::Definition &syntax) {
+            if (request == m_syntaxRequest) {
+                setSyntax(syntax);
+            }
+        });
+    });
+}
+
 void WingCodeEdit::addSymbolMark(int line, const QString &id) {
     if (!WingSymbolCenter::instance().existSymbol(id)) {
         return;
@@ -1101,17 +1485,9 @@ void WingCodeEdit::updateCursor() {
     // Ensure the block containing cursor is fully unfolded
     QTextBlock cursorBlock = textCursor().block();
     if (!cursorBlock.isVisible()) {
-        QTextBlock block = cursorBlock.previous();
-        QStack<QTextBlock> foldStack;
-        while (block.isValid()) {
-            if (WingSyntaxHighlighter::isFolded(block) &&
-                m_highlighter->foldContains(block, cursorBlock))
-                foldStack << block;
-            block = block.previous();
-        }
-        while (!foldStack.isEmpty())
-            m_highlighter->unfoldBlock(foldStack.pop());
-        WingSyntaxHighlighter::hideBlock(cursorBlock, false);
+        m_highlighter->revealBlock(cursorBlock);
+        if (!cursorBlock.isVisible())
+            WingSyntaxHighlighter::hideBlock(cursorBlock, false);
         updateScrollBars();
     }
 
@@ -1143,12 +1519,45 @@ void WingCodeEdit::updateCursor() {
     m_lineMargin->update();
 }
 
+void WingCodeEdit::updateHighlightViewport() {
+    QTextBlock block = firstVisibleBlock();
+    if (!block.isValid()) {
+        return;
+    }
+
+    const int firstBlock = block.blockNumber();
+    int lastBlock = firstBlock;
+    const qreal viewHeight = viewport()->height();
+    qreal top = blockBoundingGeometry(block).translated(contentOffset()).top();
+    while (block.isValid() && top <= viewHeight) {
+        lastBlock = block.blockNumber();
+        top += blockBoundingRect(block).height();
+        block = block.next();
+    }
+    m_highlighter->setVisibleRange(firstBlock, lastBlock);
+}
+
+void WingCodeEdit::updateHighlightPriority() {
+    using Priority = WingHighlightScheduler::Priority;
+    if (window()->isMinimized()) {
+        m_highlighter->setPriority(Priority::Paused);
+    } else if (!isVisible()) {
+        m_highlighter->setPriority(Priority::Background);
+    } else if (hasFocus()) {
+        m_highlighter->setPriority(Priority::Foreground);
+    } else {
+        m_highlighter->setPriority(Priority::Visible);
+    }
+}
+
 void WingCodeEdit::resizeEvent(QResizeEvent *e) {
     QPlainTextEdit::resizeEvent(e);
 
     QRect rect = contentsRect();
     rect.setWidth(lineMarginWidth());
     m_lineMargin->setGeometry(rect);
+
+    updateHighlightViewport();
 }
 
 void WingCodeEdit::cutLines() {
@@ -1260,9 +1669,10 @@ void WingCodeEdit::outdentSelection() {
 void WingCodeEdit::foldCurrentLine() {
     QTextCursor cursor = textCursor();
     QTextBlock block = cursor.block();
-    while (block.isValid() &&
-           !m_highlighter->foldContains(block, cursor.block()))
-        block = block.previous();
+    if (!m_highlighter->foldContains(block, block)) {
+        const auto folds = m_highlighter->enclosingFolds(block);
+        block = folds.isEmpty() ? QTextBlock() : folds.last();
+    }
     if (block.isValid() && !WingSyntaxHighlighter::isFolded(block)) {
         m_highlighter->foldBlock(block);
 
@@ -1289,20 +1699,35 @@ void WingCodeEdit::unfoldCurrentLine() {
     }
 }
 
-void WingCodeEdit::foldAll() {
-    QTextBlock block = document()->begin();
-    while (block.isValid()) {
-        if (m_highlighter->isFoldable(block))
-            m_highlighter->foldBlock(block);
-        block = block.next();
-    }
+void WingCodeEdit::foldAll() { foldToLevel(0); }
+
+void WingCodeEdit::foldToLevel(int level) {
+    m_highlighter->foldToLevel(level);
+    updateFolding();
+}
+
+void WingCodeEdit::unfoldToLevel(int level) {
+    m_highlighter->unfoldToLevel(level);
+    updateFolding();
+}
+
+void WingCodeEdit::setFoldStates(const QList<QPair<int, bool>> &changes) {
+    m_highlighter->setFoldStates(changes);
+    updateFolding();
+}
+
+void WingCodeEdit::setFoldedRanges(const QList<QPair<int, int>> &ranges) {
+    m_highlighter->setFoldedRanges(ranges);
+    updateFolding();
+}
 
+void WingCodeEdit::updateFolding() {
     // Move the editing cursor if it was in a folded block
     QTextCursor cursor = textCursor();
-    block = cursor.block();
+    QTextBlock block = cursor.block();
     while (block.isValid() && !block.isVisible())
         block = block.previous();
-    if (block.isValid()) {
+    if (block.isValid() && block != cursor.block()) {
         cursor.setPosition(block.position());
         setTextCursor(cursor);
     }
@@ -1318,8 +1743,10 @@ void WingCodeEdit::unfoldAll() {
     while (block.isValid()) {
         // Just make everything visible/unfolded regardless of what state
         // it was previously in.
-        block.setUserState(-1);
-        WingSyntaxHighlighter::hideBlock(block, false);
+        if (WingSyntaxHighlighter::isFolded(block))
+            block.setUserState(-1);
+        if (!block.isVisible())
+            WingSyntaxHighlighter::hideBlock(block, false);
         block = block.next();
     }
 
@@ -1620,6 +2047,24 @@ void WingCodeEdit::focusInEvent(QFocusEvent *e) {
     if (m_completer)
         m_completer->setWidget(this);
     QPlainTextEdit::focusInEvent(e);
+    updateHighlightPriority();
+}
+
+void WingCodeEdit::focusOutEvent(QFocusEvent *e) {
+    QPlainTextEdit::focusOutEvent(e);
+    updateHighlightPriority();
+}
+
+void WingCodeEdit::showEvent(QShowEvent *e) {
+    QPlainTextEdit::showEvent(e);
+    updateHighlightPriority();
+    // whatever was left for later while hidden is in view now
+    updateHighlightViewport();
+}
+
+void WingCodeEdit::hideEvent(QHideEvent *e) {
+    QPlainTextEdit::hideEvent(e);
+    updateHighlightPriority();
 }
 
 void WingCodeEdit::insertFromMimeData(const QMimeData *source) {
@@ -1910,35 +2355,60 @@ void WingCodeEdit::highlightSquiggle(const SquiggleInformation &info) {
 
     QTextCharFormat newcharfmt = currentCharFormat();
     newcharfmt.setFontUnderline(true);
+    newcharfmt.setUnderlineStyle(QTextCharFormat::SpellCheckUnderline);
+
+    QTextEdit::ExtraSelection newlinefmt;
+    styleSquiggle(info.level, newcharfmt, newlinefmt.format);
+    m_squigglesExtraSelections.push_back({cursor, newcharfmt});
+
+    newlinefmt.format.setProperty(QTextFormat::FullWidthSelection, true);
+    newlinefmt.cursor = cursor;
+    newlinefmt.cursor.clearSelection();
+    m_squigglesLineExtraSelections.push_back(newlinefmt);
+}
 
+void WingCodeEdit::styleSquiggle(SeverityLevel level,
+                                 QTextCharFormat &charFormat,
+                                 QTextCharFormat &lineFormat) const {
     auto color = m_editorBg;
-    switch (info.level) {
+    switch (level) {
     case SeverityLevel::Error:
-        newcharfmt.setUnderlineColor(m_errorFg);
-        newcharfmt.setUnderlineStyle(QTextCharFormat::SpellCheckUnderline);
+        charFormat.setUnderlineColor(m_errorFg);
         color = m_errorBg;
         break;
     case SeverityLevel::Warning:
-        newcharfmt.setUnderlineColor(m_warnFg);
-        newcharfmt.setUnderlineStyle(QTextCharFormat::SpellCheckUnderline);
+        charFormat.setUnderlineColor(m_warnFg);
         color = m_warnBg;
         break;
     case SeverityLevel::Information:
     case SeverityLevel::Hint:
-        newcharfmt.setUnderlineColor(m_infoFg);
-        newcharfmt.setUnderlineStyle(QTextCharFormat::SpellCheckUnderline);
+        charFormat.setUnderlineColor(m_infoFg);
         color = m_warnBg;
     }
 
-    m_squigglesExtraSelections.push_back({cursor, newcharfmt});
-
-    QTextEdit::ExtraSelection newlinefmt;
     color.setAlpha(int(color.alpha() * 0.2));
-    newlinefmt.format.setBackground(color);
-    newlinefmt.format.setProperty(QTextFormat::FullWidthSelection, true);
-    newlinefmt.cursor = cursor;
-    newlinefmt.cursor.clearSelection();
-    m_squigglesLineExtraSelections.push_back(newlinefmt);
+    lineFormat.setBackground(color);
+}
+
+void WingCodeEdit::restyleExtraSelections() {
+    for (auto &result : m_searchResults)
+        result.format.setBackground(m_searchBg);
+    for (auto &occurrence : m_occurrencesExtraSelections)
+        occurrence.format.setBackground(m_textSelBg);
+
+    // squiggle selections are built in the order of m_squiggles
+    if (m_squigglesExtraSelections.size() == m_squiggles.size() &&
+        m_squigglesLineExtraSelections.size() == m_squiggles.size()) {
+        for (qsizetype i = 0; i < m_squiggles.size(); ++i) {
+            styleSquiggle(m_squiggles.at(i).level,
+                          m_squigglesExtraSelections[i].format,
+                          m_squigglesLineExtraSelections[i].format);
+        }
+    } else if (!m_squiggles.isEmpty()) {
+        highlightAllSquiggle();
+        return;
+    }
+    updateExtraSelections();
 }
 
 void WingCodeEdit::highlightOccurrences() {
@@ -1949,20 +2419,26 @@ void WingCodeEdit::highlightOccurrences() {
         static QRegularExpression regex(
             R"((?:[_a-zA-Z][_a-zA-Z0-9]*)|(?<=\b|\s|^)(?i)(?:(?:(?:(?:(?:\d+(?:'\d+)*)?\.(?:\d+(?:'\d+)*)(?:e[+-]?(?:\d+(?:'\d+)*))?)|(?:(?:\d+(?:'\d+)*)\.(?:e[+-]?(?:\d+(?:'\d+)*))?)|(?:(?:\d+(?:'\d+)*)(?:e[+-]?(?:\d+(?:'\d+)*)))|(?:0x(?:[0-9a-f]+(?:'[0-9a-f]+)*)?\.(?:[0-9a-f]+(?:'[0-9a-f]+)*)(?:p[+-]?(?:\d+(?:'\d+)*)))|(?:0x(?:[0-9a-f]+(?:'[0-9a-f]+)*)\.?(?:p[+-]?(?:\d+(?:'\d+)*))))[lf]?)|(?:(?:(?:[1-9]\d*(?:'\d+)*)|(?:0[0-7]*(?:'[0-7]+)*)|(?:0x[0-9a-f]+(?:'[0-9a-f]+)*)|(?:0b[01]+(?:'[01]+)*))(?:u?l{0,2}|l{0,2}u?)))(?=\b|\s|$))");
         if (regex.match(text).captured() == text) {
-            auto *doc = document();
-            cursor = doc->find(text, 0,
-                               QTextDocument::FindWholeWords |
-                                   QTextDocument::FindCaseSensitively);
-            while (!cursor.isNull()) {
-                if (cursor != textCursor()) {
-                    QTextEdit::ExtraSelection e;
-                    e.cursor = cursor;
-                    e.format.setBackground(m_textSelBg);
+            const WingTextSearch search(text, true, true, false);
+            const int selectionStart = cursor.selectionStart();
+            QList<WingTextSearch::Match> matches;
+            QTextEdit::ExtraSelection e;
+            e.cursor = QTextCursor(document());
+            e.format.setBackground(m_textSelBg);
+            for (auto block = document()->begin(); block.isValid();
+                 block = block.next()) {
+                matches.clear();
+                search.matchLine(block.text(), matches);
+                const int position = block.position();
+                for (const auto &match : std::as_const(matches)) {
+                    if (position + match.offset == selectionStart)
+                        continue;
+                    e.cursor.setPosition(position + match.offset);
+                    e.cursor.setPosition(position + match.offset +
+                                             match.length,
+                                         QTextCursor::KeepAnchor);
                     m_occurrencesExtraSelections.push_back(e);
                 }
-                cursor = doc->find(text, cursor,
-                                   QTextDocument::FindWholeWords |
-                                       QTextDocument::FindCaseSensitively);
             }
         }
     }
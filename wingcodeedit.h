@@ -17,11 +17,15 @@
 #define WINGCODEEDIT_H
 
 #include "wingsignaturetooltip.h"
+#include "wingtextsearch.h"
 
 #include <KSyntaxHighlighting/Theme>
+#include <QFuture>
 #include <QPlainTextEdit>
 #include <QTextBlock>
 
+#include <functional>
+
 namespace KSyntaxHighlighting {
 class Repository;
 class Definition;
@@ -32,6 +36,9 @@ class WingSyntaxHighlighter;
 class WingCompleter;
 class WingLineMargin;
 class QPrinter;
+class QTimer;
+template <typename T>
+class QFutureWatcher;
 
 class WingCodeEdit : public QPlainTextEdit {
     Q_OBJECT
@@ -47,6 +54,8 @@ public:
         bool caseSensitive = false;
         bool wholeWord = false;
         bool regex = false;
+        /** a regex matched against the whole text, across lines */
+        bool multiLine = false;
     };
 
 public:
@@ -108,16 +117,42 @@ public:
 
     bool isCurrentLineFolded() const;
 
+    /** Finds the next match from @p start, or the previous one if
+     *  @p reverse is set. An empty match at an empty @p start is skipped,
+     *  so repeated searches move on. @p regexMatch receives the match of
+     *  a regex search, with offsets into the block, or into the document
+     *  text of a multi-line search. @p matchFirst is deprecated and
+     *  ignored.
+     */
     QTextCursor textSearch(const QTextCursor &start, const SearchParams &params,
                            bool matchFirst, bool reverse = false,
                            QRegularExpressionMatch *regexMatch = nullptr);
     void setLiveSearch(const SearchParams &params);
     void clearLiveSearch();
 
+    /** Searches a snapshot of the whole document on the thread pool. The
+     *  matches arrive in document order through searchResultsReady(),
+     *  followed by searchFinished(). Another search, an edit or
+     *  cancelSearch() cancels a running search.
+     */
+    void startSearch(const SearchParams &params);
+    void cancelSearch();
+    bool isSearching() const;
+
     void setMatchBraces(bool match);
     bool matchBraces() const;
 
+    /** Returns the shared syntax repository, waiting for
+     *  preloadSyntaxRepo() to finish or loading it right away.
+     */
     static KSyntaxHighlighting::Repository &syntaxRepo();
+
+    /** Starts loading the shared syntax repository on a worker thread.
+     *  Editors created while it is loading apply their default theme once
+     *  it is ready instead of blocking the constructor.
+     */
+    static void preloadSyntaxRepo();
+    static bool isSyntaxRepoReady();
     static const KSyntaxHighlighting::Definition &nullSyntax();
 
     void setDefaultFont(const QFont &font);
@@ -138,6 +173,17 @@ public:
 
     void setHighlighter(WingSyntaxHighlighter *newHighlighter);
 
+    /** Stores highlighting checkpoints every @p checkpointInterval lines,
+     *  folds, symbol marks and the scroll position of the current text in
+     *  the editor state cache.
+     */
+    bool saveEditorState(int checkpointInterval = 1000) const;
+
+    /** Restores the state saved for identical text. Returns false if the
+     *  cache holds none.
+     */
+    bool restoreEditorState();
+
     QList<QTextEdit::ExtraSelection> extraSelections() const;
     void setExtraSelections(const QList<QTextEdit::ExtraSelection> &selections);
 
@@ -167,6 +213,9 @@ signals:
     void squiggleItemChanged();
     void themeChanged();
 
+    void searchResultsReady(const QList<QTextCursor> &matches);
+    void searchFinished();
+
 public slots:
     void setShowLineNumbers(bool show);
     void setShowFolding(bool show);
@@ -193,6 +242,11 @@ public slots:
     void setTheme(const KSyntaxHighlighting::Theme &theme);
     void setSyntax(const KSyntaxHighlighting::Definition &syntax);
 
+    /** Looks up and loads the definition @p name on a worker thread and
+     *  applies it once it is ready, unless another syntax is set first.
+     */
+    void setSyntaxAsync(const QString &name);
+
     void addSymbolMark(int line, const QString &id);
     void removeSymbolMark(int line);
 
@@ -222,6 +276,9 @@ protected:
     void wheelEvent(QWheelEvent *e) override;
     void paintEvent(QPaintEvent *e) override;
     void focusInEvent(QFocusEvent *e) override;
+    void focusOutEvent(QFocusEvent *e) override;
+    void showEvent(QShowEvent *e) override;
+    void hideEvent(QHideEvent *e) override;
 
     void insertFromMimeData(const QMimeData *source) override;
 
@@ -245,6 +302,9 @@ private:
     };
 
     void highlightSquiggle(const SquiggleInformation &info);
+    void styleSquiggle(SeverityLevel level, QTextCharFormat &charFormat,
+                       QTextCharFormat &lineFormat) const;
+    void restyleExtraSelections();
 
 protected:
     virtual void highlightOccurrences();
@@ -263,6 +323,16 @@ public slots:
     void foldAll();
     void unfoldAll();
 
+    /** @see WingSyntaxHighlighter::foldToLevel */
+    void foldToLevel(int level);
+    /** @see WingSyntaxHighlighter::unfoldToLevel */
+    void unfoldToLevel(int level);
+
+    /** @see WingSyntaxHighlighter::setFoldStates */
+    void setFoldStates(const QList<QPair<int, bool>> &changes);
+    /** @see WingSyntaxHighlighter::setFoldedRanges */
+    void setFoldedRanges(const QList<QPair<int, int>> &ranges);
+
     void zoomIn();  // Hides QPlainTextEdit::zoomIn(int = 1)
     void zoomOut(); // Hides QPlainTextEdit::zoomOut(int = 1)
     void zoomReset();
@@ -277,6 +347,12 @@ private slots:
     void updateTabMetrics();
     void updateTextMetrics();
     void updateLiveSearch();
+    void refineLiveSearch();
+    void updateContents(int position, int charsRemoved, int charsAdded);
+    void updateLiveSearchRange(int position, int charsAdded);
+    void updateLiveSearchResults(int begin, int end);
+    void updateHighlightViewport();
+    void updateHighlightPriority();
 
 protected slots:
     void updateExtraSelections();
@@ -315,7 +391,28 @@ private:
 
     QPixmap m_foldOpen, m_foldClosed;
 
-    SearchParams m_liveSearch;
+    // bumped on every syntax change, so a late async lookup is dropped
+    int m_syntaxRequest = 0;
+
+    // the live search matches are kept in document order and only the
+    // edited blocks are searched again
+    WingTextSearch m_liveSearch;
+    int m_contentsRevision = -1;
+
+    // documents larger than this many characters are searched in the
+    // background, see WingTextSearch::run()
+    static constexpr int AsyncSearchThreshold = 1 << 20;
+    QFutureWatcher<WingTextSearch::Batch> *m_liveSearchWatcher;
+    // edits rescan the whole document for a multi-line or background live
+    // search only once typing pauses
+    QTimer *m_liveSearchTimer;
+    QFutureWatcher<WingTextSearch::Batch> *m_searchWatcher;
+    WingTextSearchCache m_searchCache;
+    // the document text textSearch() runs multi-line searches on, empty
+    // until needed and after every edit; background searches get their
+    // own copy, released when they finish
+    QString m_searchSnapshot;
+    bool m_searchSnapshotValid = false;
     QList<QTextEdit::ExtraSelection> m_extraSelections;
     QList<QTextEdit::ExtraSelection> m_braceMatch;
     QList<QTextEdit::ExtraSelection> m_searchResults;
@@ -323,6 +420,22 @@ private:
         m_squigglesLineExtraSelections;
 
     void updateScrollBars();
+    void updateFolding();
+    void matchLiveSearch(QTextBlock block, const QTextBlock &lastBlock,
+                         QList<QTextEdit::ExtraSelection> &results) const;
+    WingTextSearch compileSearch(const SearchParams &params);
+    const QString &searchSnapshot();
+
+    static QFuture<KSyntaxHighlighting::Repository *> &syntaxRepoFuture();
+
+    /** Calls @p callback on the GUI thread once the syntax repository is
+     *  loaded, right away if it is, unless @p context is gone by then.
+     *  A QFuture keeps only one continuation, so every editor waits here.
+     */
+    static void whenSyntaxRepoReady(
+        QObject *context,
+        const std::function<void(KSyntaxHighlighting::Repository *)>
+            &callback);
 
 protected:
     QList<QTextEdit::ExtraSelection> m_occurrencesExtraSelections;
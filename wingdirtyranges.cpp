@@ -0,0 +1,154 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "wingdirtyranges.h"
+
+#include <algorithm>
+
+void WingDirtyRanges::add(int first, int last) {
+    if (last < first) {
+        return;
+    }
+
+    // first range that ends at or after the block before first
+    auto it = std::lower_bound(
+        m_ranges.begin(), m_ranges.end(), first - 1,
+        [](const Range &range, int block) { return range.last < block; });
+    if (it == m_ranges.end() || it->first > last + 1) {
+        m_ranges.insert(it, {first, last});
+        return;
+    }
+
+    // merge every range that overlaps or touches [first, last]
+    it->first = qMin(it->first, first);
+    it->last = qMax(it->last, last);
+    auto next = it + 1;
+    while (next != m_ranges.end() && next->first <= it->last + 1) {
+        it->last = qMax(it->last, next->last);
+        ++next;
+    }
+    m_ranges.erase(it + 1, next);
+}
+
+void WingDirtyRanges::remove(int block) {
+    auto it = std::lower_bound(
+        m_ranges.begin(), m_ranges.end(), block,
+        [](const Range &range, int block) { return range.last < block; });
+    if (it == m_ranges.end() || it->first > block) {
+        return;
+    }
+
+    if (it->first == it->last) {
+        m_ranges.erase(it);
+    } else if (it->first == block) {
+        ++it->first;
+    } else if (it->last == block) {
+        --it->last;
+    } else {
+        const Range tail{block + 1, it->last};
+        it->last = block - 1;
+        m_ranges.insert(it + 1, tail);
+    }
+}
+
+void WingDirtyRanges::remove(int first, int last) {
+    if (last < first) {
+        return;
+    }
+
+    // ranges reaching past [first, last] keep their outer parts
+    QVector<Range> ranges;
+    ranges.reserve(m_ranges.size() + 1);
+    for (const auto &range : std::as_const(m_ranges)) {
+        if (range.last < first || range.first > last) {
+            ranges.append(range);
+            continue;
+        }
+        if (range.first < first) {
+            ranges.append({range.first, first - 1});
+        }
+        if (range.last > last) {
+            ranges.append({last + 1, range.last});
+        }
+    }
+    m_ranges = ranges;
+}
+
+void WingDirtyRanges::clear() { m_ranges.clear(); }
+
+bool WingDirtyRanges::contains(int block) const {
+    auto it = std::lower_bound(
+        m_ranges.cbegin(), m_ranges.cend(), block,
+        [](const Range &range, int block) { return range.last < block; });
+    return it != m_ranges.cend() && it->first <= block;
+}
+
+bool WingDirtyRanges::isEmpty() const { return m_ranges.isEmpty(); }
+
+int WingDirtyRanges::first() const {
+    return m_ranges.isEmpty() ? -1 : m_ranges.first().first;
+}
+
+qsizetype WingDirtyRanges::count() const {
+    qsizetype total = 0;
+    for (const auto &range : m_ranges) {
+        total += range.last - range.first + 1;
+    }
+    return total;
+}
+
+void WingDirtyRanges::blocksChanged(int block, int removed, int added) {
+    if ((removed == 0 && added == 0) || m_ranges.isEmpty()) {
+        return;
+    }
+
+    // removed blocks collapse into the block they were merged with
+    auto map = [block, removed, added](int n) {
+        if (n <= block) {
+            return n;
+        }
+        if (n <= block + removed) {
+            return block;
+        }
+        return n - removed + added;
+    };
+    for (auto &range : m_ranges) {
+        range.first = map(range.first);
+        range.last = map(range.last);
+    }
+    normalize();
+}
+
+const QVector<WingDirtyRanges::Range> &WingDirtyRanges::ranges() const {
+    return m_ranges;
+}
+
+void WingDirtyRanges::normalize() {
+    if (m_ranges.size() < 2) {
+        return;
+    }
+
+    int out = 0;
+    for (int i = 1; i < m_ranges.size(); ++i) {
+        auto &last = m_ranges[out];
+        const auto &range = m_ranges.at(i);
+        if (range.first <= last.last + 1) {
+            last.last = qMax(last.last, range.last);
+        } else {
+            m_ranges[++out] = range;
+        }
+    }
+    m_ranges.resize(out + 1);
+}
@@ -0,0 +1,58 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGDIRTYRANGES_H
+#define WINGDIRTYRANGES_H
+
+#include <QVector>
+
+/**
+ * A sorted set of block numbers kept as disjoint, non-adjacent ranges,
+ * so a cascade over thousands of lines costs a single entry.
+ */
+class WingDirtyRanges {
+public:
+    struct Range {
+        int first;
+        int last;
+    };
+
+public:
+    void add(int first, int last);
+    void add(int block) { add(block, block); }
+    void remove(int block);
+    void remove(int first, int last);
+    void clear();
+
+    bool contains(int block) const;
+    bool isEmpty() const;
+    int first() const;
+    qsizetype count() const;
+
+    /** Keeps the ranges in sync after the @p removed blocks right after
+     *  @p block were replaced with @p added new ones.
+     */
+    void blocksChanged(int block, int removed, int added);
+
+    const QVector<Range> &ranges() const;
+
+private:
+    void normalize();
+
+private:
+    QVector<Range> m_ranges;
+};
+
+#endif // WINGDIRTYRANGES_H
@@ -0,0 +1,141 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "wingeditorstatecache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QTextBlock>
+#include <QTextDocument>
+
+static constexpr quint32 StateMagic = 0x57455343; // "WESC"
+static constexpr quint16 StateVersion = 1;
+
+static QString &cachePath() {
+    static QString s_path =
+        QStandardPaths::writableLocation(QStandardPaths::CacheLocation) +
+        QStringLiteral("/editor-state");
+    return s_path;
+}
+
+static int &cacheEntries() {
+    static int s_entries = 500;
+    return s_entries;
+}
+
+static QString cacheFile(const QByteArray &key) {
+    return cachePath() + QLatin1Char('/') + QString::fromLatin1(key) +
+           QStringLiteral(".state");
+}
+
+QString WingEditorStateCache::cacheDirectory() { return cachePath(); }
+
+void WingEditorStateCache::setCacheDirectory(const QString &path) {
+    cachePath() = path;
+}
+
+int WingEditorStateCache::maxEntries() { return cacheEntries(); }
+
+void WingEditorStateCache::setMaxEntries(int entries) {
+    cacheEntries() = qMax(1, entries);
+}
+
+static void pruneCache() {
+    // the modification time is the last use, newest first
+    const auto files =
+        QDir(cachePath())
+            .entryInfoList({QStringLiteral("*.state")}, QDir::Files,
+                           QDir::Time);
+    for (qsizetype i = cacheEntries(); i < files.size(); ++i) {
+        QFile::remove(files.at(i).filePath());
+    }
+}
+
+QByteArray WingEditorStateCache::contentKey(const QTextDocument *doc) {
+    // hash block by block instead of building the whole plain text
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    for (auto block = doc->begin(); block.isValid(); block = block.next()) {
+        const auto text = block.text();
+        hash.addData(QByteArrayView(
+            reinterpret_cast<const char *>(text.constData()),
+            text.size() * qsizetype(sizeof(QChar))));
+        hash.addData(QByteArrayView("\n", 1));
+    }
+    return hash.result().toHex();
+}
+
+bool WingEditorStateCache::load(const QByteArray &key, WingEditorState &state) {
+    QFile file(cacheFile(key));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_6_0);
+    quint32 magic;
+    quint16 version;
+    in >> magic >> version;
+    if (magic != StateMagic || version != StateVersion) {
+        return false;
+    }
+
+    WingEditorState loaded;
+    in >> loaded.syntax >> loaded.checkpoints >> loaded.folds >>
+        loaded.symbolMarks >> loaded.cursorPosition >> loaded.scrollPosition;
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+    state = std::move(loaded);
+
+    // mark as recently used
+    file.close();
+    if (file.open(QIODevice::ReadWrite)) {
+        file.setFileTime(QDateTime::currentDateTime(),
+                         QFileDevice::FileModificationTime);
+    }
+    return true;
+}
+
+bool WingEditorStateCache::save(const QByteArray &key,
+                                const WingEditorState &state) {
+    if (!QDir().mkpath(cachePath())) {
+        return false;
+    }
+
+    QSaveFile file(cacheFile(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_6_0);
+    out << StateMagic << StateVersion;
+    out << state.syntax << state.checkpoints << state.folds
+        << state.symbolMarks << state.cursorPosition << state.scrollPosition;
+    if (out.status() != QDataStream::Ok || !file.commit()) {
+        return false;
+    }
+    pruneCache();
+    return true;
+}
+
+void WingEditorStateCache::remove(const QByteArray &key) {
+    QFile::remove(cacheFile(key));
+}
@@ -0,0 +1,62 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGEDITORSTATECACHE_H
+#define WINGEDITORSTATECACHE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+class QTextDocument;
+
+/**
+ * Everything needed to show a file the way it was left, without scanning
+ * or highlighting it from the first line.
+ */
+struct WingEditorState {
+    QString syntax;
+    /** blocks ending in the root highlighting state */
+    QList<int> checkpoints;
+    /** folded blocks and the last block hidden after each of them */
+    QList<QPair<int, int>> folds;
+    /** 1-based line numbers and symbol ids */
+    QList<QPair<int, QString>> symbolMarks;
+    int cursorPosition = 0;
+    int scrollPosition = 0;
+};
+
+/**
+ * On-disk cache of editor states keyed by a hash of the text, so a state
+ * is only ever restored into identical content. Every save() drops the
+ * least recently used states beyond maxEntries().
+ */
+class WingEditorStateCache {
+public:
+    static QString cacheDirectory();
+    static void setCacheDirectory(const QString &path);
+
+    static int maxEntries();
+    static void setMaxEntries(int entries);
+
+    static QByteArray contentKey(const QTextDocument *doc);
+
+    static bool load(const QByteArray &key, WingEditorState &state);
+    static bool save(const QByteArray &key, const WingEditorState &state);
+    static void remove(const QByteArray &key);
+};
+
+#endif // WINGEDITORSTATECACHE_H
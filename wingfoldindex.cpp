@@ -0,0 +1,494 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "wingfoldindex.h"
+#include "wingblockmetadata.h"
+
+#include <algorithm>
+
+using namespace KSyntaxHighlighting;
+
+void WingFoldIndex::update(const WingBlockMetadata &blocks) {
+    while (!m_dirty.isEmpty()) {
+        rescan(blocks, qMin(m_dirty.first(), blocks.size()));
+    }
+}
+
+void WingFoldIndex::regionsChanged(int block) { m_dirty.add(block); }
+
+void WingFoldIndex::blocksChanged(int block, int removed, int added) {
+    if (removed == 0 && added == 0) {
+        return;
+    }
+    m_dirty.blocksChanged(block, removed, added);
+    m_dirty.add(block + 1, block + qMax(added, 1));
+
+    // the regions begun in removed blocks and still open after them are
+    // kept as placeholders, so the next update compares against the
+    // previous pairing as it really was
+    const int delta = added - removed;
+    QList<Region> open;
+    QList<Region> removedRegions;
+    const int gone = moveBlocks(block, removed, added, open);
+    release(takeOpen(gone, block + removed + 1, removedRegions));
+    for (auto region : std::as_const(removedRegions)) {
+        region.block = block + 1;
+        region.index = --m_removedIndex;
+        region.end = shifted(region.end, delta);
+        region.starts = false;
+        insert(region);
+    }
+
+    // the regions open across the change end after it or were closed in
+    // a removed block
+    for (auto region : std::as_const(open)) {
+        if (region.end < Unknown) {
+            region.end =
+                region.end > block + removed ? region.end + delta : Unknown;
+        }
+        insert(region);
+    }
+}
+
+void WingFoldIndex::moveFolds(int block, int removed, int added) {
+    if (removed == 0 && added == 0) {
+        return;
+    }
+
+    // the folds ending in a removed block end right before it for now
+    const int delta = added - removed;
+    QList<Region> open;
+    release(moveBlocks(block, removed, added, open));
+    for (auto region : std::as_const(open)) {
+        region.end = region.end > block + removed ? region.end + delta : block;
+        insert(region);
+    }
+}
+
+void WingFoldIndex::setFoldEnd(int block, int end) {
+    if (end >= 0) {
+        insert({block, 0, 0, end, true});
+        return;
+    }
+    int l, mid, r;
+    split(m_root, block, FirstIndex, l, r);
+    split(r, block + 1, FirstIndex, mid, r);
+    release(mid);
+    m_root = merge(l, r);
+}
+
+void WingFoldIndex::clear() {
+    m_nodes.clear();
+    m_freeNodes.clear();
+    m_root = -1;
+    m_dirty.clear();
+}
+
+int WingFoldIndex::foldEnd(int block) const {
+    // the fold starts at the last region begun in the block
+    int t = m_root;
+    int offset = 0;
+    int found = -1;
+    int foundOffset = 0;
+    while (t >= 0) {
+        const auto &node = m_nodes.at(t);
+        if (node.region.block + offset <= block) {
+            found = t;
+            foundOffset = offset;
+            t = node.right;
+        } else {
+            t = node.left;
+        }
+        offset += node.shift;
+    }
+    if (found < 0) {
+        return -1;
+    }
+    const auto &region = m_nodes.at(found).region;
+    if (region.block + foundOffset != block || !region.starts ||
+        region.end >= Unknown) {
+        return -1;
+    }
+    return region.end + foundOffset;
+}
+
+bool WingFoldIndex::contains(int foldBlock, int block) const {
+    const int end = foldEnd(foldBlock);
+    return end >= 0 && block >= foldBlock && block <= end;
+}
+
+QList<int> WingFoldIndex::enclosingFolds(int block) const {
+    QList<int> result;
+    collect(m_root, 0, block, result);
+    return result;
+}
+
+QList<WingFoldIndex::Fold> WingFoldIndex::folds() const {
+    QList<Fold> result;
+    collectFolds(m_root, 0, result);
+    return result;
+}
+
+void WingFoldIndex::rescan(const WingBlockMetadata &blocks, int first) {
+    const int count = blocks.size();
+
+    // the regions begun above the first changed block and still open
+    // there are paired again, along with every region begun below it
+    // until the open regions are the same as before
+    int l, r;
+    split(m_root, first, FirstIndex, l, r);
+    QList<Region> previous;
+    l = takeOpen(l, first, previous);
+
+    QHash<int, QList<Region>> stacks;
+    for (const auto &region : std::as_const(previous)) {
+        stacks[region.id].append(region);
+    }
+    qsizetype depth = previous.size();
+    QList<Region> paired;
+
+    Region next{};
+    bool hasNext = r >= 0;
+    if (hasNext) {
+        r = takeFirst(r, next);
+    }
+
+    constexpr auto foldFlags =
+        WingBlockMetadata::FoldBegin | WingBlockMetadata::FoldEnd;
+    int last = qMax(first, dirtyEnd(first));
+    int block = first;
+    for (; block < count; ++block) {
+        if (block > last) {
+            const int end = dirtyEnd(block);
+            if (end >= 0) {
+                last = end;
+            } else if (converged(stacks, depth, previous)) {
+                break;
+            }
+        }
+
+        // the regions the previous pairing begun here
+        while (hasNext && next.block == block) {
+            previous.append(next);
+            hasNext = r >= 0;
+            if (hasNext) {
+                r = takeFirst(r, next);
+            }
+        }
+
+        if (blocks.flags(block) & foldFlags) {
+            const auto &regions = blocks.foldingRegions(block);
+            qsizetype lastBegin = -1;
+            for (qsizetype i = 0; i < regions.size(); ++i) {
+                if (regions.at(i).type() == FoldingRegion::Begin) {
+                    lastBegin = i;
+                }
+            }
+            for (qsizetype i = 0; i < regions.size(); ++i) {
+                const auto &region = regions.at(i);
+                auto &stack = stacks[region.id()];
+                if (region.type() == FoldingRegion::Begin) {
+                    stack.append({block, int(i), region.id(), Open,
+                                  i == lastBegin});
+                    ++depth;
+                } else if (!stack.isEmpty()) {
+                    auto begin = stack.takeLast();
+                    begin.end = block;
+                    paired.append(begin);
+                    --depth;
+                }
+            }
+        }
+
+        previous.removeIf(
+            [block](const Region &region) { return region.end <= block; });
+    }
+
+    // the regions still open close where they did before, or never
+    QList<Region> open;
+    open.reserve(depth);
+    for (const auto &stack : std::as_const(stacks)) {
+        open.append(stack);
+    }
+    if (block < count) {
+        std::sort(open.begin(), open.end(), precedes);
+        for (qsizetype i = 0; i < open.size(); ++i) {
+            open[i].end = previous.at(i).end;
+        }
+        m_dirty.remove(first, block - 1);
+    } else {
+        for (auto &region : open) {
+            region.end = Open;
+        }
+        release(r);
+        r = -1;
+        hasNext = false;
+        m_dirty.remove(first, Open);
+    }
+
+    m_root = merge(l, r);
+    if (hasNext) {
+        insert(next);
+    }
+    for (const auto &region : std::as_const(paired)) {
+        insert(region);
+    }
+    for (const auto &region : std::as_const(open)) {
+        insert(region);
+    }
+}
+
+bool WingFoldIndex::converged(const QHash<int, QList<Region>> &stacks,
+                              qsizetype depth,
+                              const QList<Region> &previous) const {
+    if (depth != previous.size()) {
+        return false;
+    }
+
+    QList<Region> open;
+    open.reserve(depth);
+    for (const auto &stack : stacks) {
+        open.append(stack);
+    }
+    std::sort(open.begin(), open.end(), precedes);
+    for (qsizetype i = 0; i < open.size(); ++i) {
+        const auto &a = open.at(i);
+        const auto &b = previous.at(i);
+        if (a.block != b.block || a.index != b.index || a.id != b.id ||
+            b.end == Unknown) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool WingFoldIndex::precedes(const Region &a, const Region &b) {
+    return a.block < b.block || (a.block == b.block && a.index < b.index);
+}
+
+int WingFoldIndex::dirtyEnd(int block) const {
+    const auto &ranges = m_dirty.ranges();
+    const auto it = std::lower_bound(
+        ranges.cbegin(), ranges.cend(), block,
+        [](const WingDirtyRanges::Range &range, int b) {
+            return range.last < b;
+        });
+    return it != ranges.cend() && it->first <= block ? it->last : -1;
+}
+
+void WingFoldIndex::insert(const Region &region) {
+    const int t = newNode(region);
+    int l, mid, r;
+    split(m_root, region.block, region.index, l, r);
+    split(r, region.block, region.index + 1, mid, r);
+    release(mid);
+    m_root = merge(merge(l, t), r);
+}
+
+int WingFoldIndex::newNode(const Region &region) {
+    // xorshift priorities keep the treap balanced
+    m_seed ^= m_seed << 13;
+    m_seed ^= m_seed >> 17;
+    m_seed ^= m_seed << 5;
+    const Node node{region, region.end, 0, m_seed, -1, -1};
+    if (!m_freeNodes.isEmpty()) {
+        const int t = m_freeNodes.takeLast();
+        m_nodes[t] = node;
+        return t;
+    }
+    m_nodes.append(node);
+    return int(m_nodes.size() - 1);
+}
+
+int WingFoldIndex::moveBlocks(int block, int removed, int added,
+                              QList<Region> &open) {
+    // the regions after the removed blocks move, the ones begun in them
+    // are returned as a subtree and the ones open across them taken out
+    int l, gone, r;
+    split(m_root, block + 1, FirstIndex, l, r);
+    split(r, block + removed + 1, FirstIndex, gone, r);
+    if (r >= 0) {
+        apply(r, added - removed);
+    }
+    l = takeOpen(l, block + 1, open);
+    m_root = merge(l, r);
+    return gone;
+}
+
+int WingFoldIndex::shifted(int end, int delta) {
+    // the sentinel ends stay where they are
+    return end < Unknown ? end + delta : end;
+}
+
+void WingFoldIndex::release(int t) {
+    if (t < 0) {
+        return;
+    }
+    release(m_nodes.at(t).left);
+    release(m_nodes.at(t).right);
+    m_freeNodes.append(t);
+}
+
+void WingFoldIndex::apply(int t, int delta) {
+    auto &node = m_nodes[t];
+    node.region.block += delta;
+    node.region.end = shifted(node.region.end, delta);
+    node.maxEnd = shifted(node.maxEnd, delta);
+    node.shift += delta;
+}
+
+void WingFoldIndex::push(int t) {
+    auto &node = m_nodes[t];
+    if (node.shift == 0) {
+        return;
+    }
+    if (node.left >= 0) {
+        apply(node.left, node.shift);
+    }
+    if (node.right >= 0) {
+        apply(node.right, node.shift);
+    }
+    node.shift = 0;
+}
+
+void WingFoldIndex::pull(int t) {
+    auto &node = m_nodes[t];
+    node.maxEnd = node.region.end;
+    if (node.left >= 0) {
+        node.maxEnd = qMax(node.maxEnd, m_nodes.at(node.left).maxEnd);
+    }
+    if (node.right >= 0) {
+        node.maxEnd = qMax(node.maxEnd, m_nodes.at(node.right).maxEnd);
+    }
+}
+
+void WingFoldIndex::split(int t, int block, int index, int &l, int &r) {
+    // l gets the regions ordered before (block, index)
+    if (t < 0) {
+        l = r = -1;
+        return;
+    }
+    push(t);
+    const auto &region = m_nodes.at(t).region;
+    if (region.block < block ||
+        (region.block == block && region.index < index)) {
+        int right;
+        split(m_nodes.at(t).right, block, index, right, r);
+        m_nodes[t].right = right;
+        l = t;
+    } else {
+        int left;
+        split(m_nodes.at(t).left, block, index, l, left);
+        m_nodes[t].left = left;
+        r = t;
+    }
+    pull(t);
+}
+
+int WingFoldIndex::merge(int l, int r) {
+    if (l < 0) {
+        return r;
+    }
+    if (r < 0) {
+        return l;
+    }
+    if (m_nodes.at(l).priority > m_nodes.at(r).priority) {
+        push(l);
+        const int right = merge(m_nodes.at(l).right, r);
+        m_nodes[l].right = right;
+        pull(l);
+        return l;
+    }
+    push(r);
+    const int left = merge(l, m_nodes.at(r).left);
+    m_nodes[r].left = left;
+    pull(r);
+    return r;
+}
+
+int WingFoldIndex::takeFirst(int t, Region &region) {
+    push(t);
+    const int left = m_nodes.at(t).left;
+    if (left < 0) {
+        region = m_nodes.at(t).region;
+        m_freeNodes.append(t);
+        return m_nodes.at(t).right;
+    }
+    const int rest = takeFirst(left, region);
+    m_nodes[t].left = rest;
+    pull(t);
+    return t;
+}
+
+int WingFoldIndex::takeOpen(int t, int block, QList<Region> &open) {
+    // takes the regions still open at the block, in order
+    if (t < 0 || m_nodes.at(t).maxEnd < block) {
+        return t;
+    }
+    push(t);
+    const int left = takeOpen(m_nodes.at(t).left, block, open);
+    const bool take = m_nodes.at(t).region.end >= block;
+    if (take) {
+        open.append(m_nodes.at(t).region);
+    }
+    const int right = takeOpen(m_nodes.at(t).right, block, open);
+    if (take) {
+        m_freeNodes.append(t);
+        return merge(left, right);
+    }
+    m_nodes[t].left = left;
+    m_nodes[t].right = right;
+    pull(t);
+    return t;
+}
+
+void WingFoldIndex::collect(int t, int offset, int block,
+                            QList<int> &result) const {
+    // subtrees ending above the block hold nothing that encloses it
+    if (t < 0) {
+        return;
+    }
+    const auto &node = m_nodes.at(t);
+    if (shifted(node.maxEnd, offset) < block) {
+        return;
+    }
+    const int childOffset = offset + node.shift;
+    collect(node.left, childOffset, block, result);
+    const auto &region = node.region;
+    if (region.block + offset >= block) {
+        return;
+    }
+    if (region.starts && region.end < Unknown &&
+        region.end + offset >= block) {
+        result.append(region.block + offset);
+    }
+    collect(node.right, childOffset, block, result);
+}
+
+void WingFoldIndex::collectFolds(int t, int offset,
+                                 QList<Fold> &result) const {
+    if (t < 0) {
+        return;
+    }
+    const auto &node = m_nodes.at(t);
+    const int childOffset = offset + node.shift;
+    collectFolds(node.left, childOffset, result);
+    const auto &region = node.region;
+    if (region.starts) {
+        result.append({region.block + offset,
+                       region.end < Unknown ? region.end + offset : -1});
+    }
+    collectFolds(node.right, childOffset, result);
+}
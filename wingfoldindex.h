@@ -0,0 +1,153 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGFOLDINDEX_H
+#define WINGFOLDINDEX_H
+
+#include "wingdirtyranges.h"
+
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+#include <limits>
+
+class WingBlockMetadata;
+
+/**
+ * The folds of a document as an interval tree: a treap of the begun
+ * folding regions ordered by their first block, each node knowing the
+ * largest last block below it. Block numbers after an edit are shifted
+ * lazily, and only the regions around changed blocks are paired again,
+ * until the pairing matches the previous one.
+ */
+class WingFoldIndex {
+public:
+    struct Fold {
+        int begin;
+        /** -1 if not terminated */
+        int end;
+    };
+
+    /** Pairs the folding regions around the blocks changed since the last
+     *  update again
+     */
+    void update(const WingBlockMetadata &blocks);
+
+    /** Marks the folding regions of @p block as changed */
+    void regionsChanged(int block);
+
+    /** Keeps the folds in sync after the @p removed blocks right after
+     *  @p block were replaced with @p added new ones; the regions around
+     *  them are paired again by the next update().
+     */
+    void blocksChanged(int block, int removed, int added);
+
+    /** Sets the last block of the fold starting at @p block, removes the
+     *  fold if @p end is negative; for folds not made of folding regions
+     */
+    void setFoldEnd(int block, int end);
+
+    /** Keeps the folds set with setFoldEnd() in sync after the @p removed
+     *  blocks right after @p block were replaced with @p added new ones;
+     *  the folds ending in a removed block end at @p block until set again.
+     */
+    void moveFolds(int block, int removed, int added);
+
+    void clear();
+
+    /** Returns the last block of the fold starting at @p block, -1 if no
+     *  fold starts there or it is not terminated.
+     */
+    int foldEnd(int block) const;
+
+    /** Returns whether @p block lies within the fold starting at
+     *  @p foldBlock, including its first and last blocks.
+     */
+    bool contains(int foldBlock, int block) const;
+
+    /** Returns the first blocks of the folds @p block is hidden in when
+     *  they are folded, outermost first.
+     */
+    QList<int> enclosingFolds(int block) const;
+
+    /** All folds sorted by their first block */
+    QList<Fold> folds() const;
+
+private:
+    /** end of a region never closed */
+    static constexpr int Open = std::numeric_limits<int>::max();
+    /** end of a region closed in a removed block, until paired again */
+    static constexpr int Unknown = Open - 1;
+    /** orders before every region of a block */
+    static constexpr int FirstIndex = std::numeric_limits<int>::min();
+
+    /** A begun folding region; a fold starts at the last one of a block */
+    struct Region {
+        int block;
+        /** position among the folding regions of the block, negative
+         *  for a region begun in a removed block until paired again
+         */
+        int index;
+        int id;
+        int end;
+        bool starts;
+    };
+
+    struct Node {
+        Region region;
+        int maxEnd;
+        /** block delta not yet applied to the children */
+        int shift;
+        quint32 priority;
+        int left;
+        int right;
+    };
+
+    void rescan(const WingBlockMetadata &blocks, int first);
+    bool converged(const QHash<int, QList<Region>> &stacks, qsizetype depth,
+                   const QList<Region> &previous) const;
+    static bool precedes(const Region &a, const Region &b);
+    int dirtyEnd(int block) const;
+
+    int moveBlocks(int block, int removed, int added, QList<Region> &open);
+    void insert(const Region &region);
+    int newNode(const Region &region);
+    void release(int t);
+    static int shifted(int end, int delta);
+    void apply(int t, int delta);
+    void push(int t);
+    void pull(int t);
+    void split(int t, int block, int index, int &l, int &r);
+    int merge(int l, int r);
+    int takeFirst(int t, Region &region);
+    int takeOpen(int t, int block, QList<Region> &open);
+
+    void collect(int t, int offset, int block, QList<int> &result) const;
+    void collectFolds(int t, int offset, QList<Fold> &result) const;
+
+private:
+    QVector<Node> m_nodes;
+    QVector<int> m_freeNodes;
+    int m_root = -1;
+    quint32 m_seed = 0x9e3779b9;
+    // negative positions of the regions begun in removed blocks
+    int m_removedIndex = 0;
+
+    // blocks whose folding regions changed since the last update
+    WingDirtyRanges m_dirty;
+};
+
+#endif // WINGFOLDINDEX_H
@@ -0,0 +1,49 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "winghighlightbackend.h"
+#include "wingjsonlexer.h"
+
+#include <QHash>
+
+static QHash<QString, WingHighlightBackend::Factory> &factories() {
+    static QHash<QString, WingHighlightBackend::Factory> ins{
+        {QStringLiteral("JSON"), &WingJsonLexer::create},
+    };
+    return ins;
+}
+
+WingHighlightBackend::~WingHighlightBackend() {}
+
+void WingHighlightBackend::registerBackend(const QString &definitionName,
+                                           const Factory &factory) {
+    if (!factory) {
+        return;
+    }
+    factories().insert(definitionName, factory);
+}
+
+void WingHighlightBackend::unregisterBackend(const QString &definitionName) {
+    factories().remove(definitionName);
+}
+
+QSharedPointer<const WingHighlightBackend>
+WingHighlightBackend::create(const KSyntaxHighlighting::Definition &def) {
+    if (!def.isValid()) {
+        return {};
+    }
+    const auto factory = factories().value(def.name());
+    return factory ? factory(def) : nullptr;
+}
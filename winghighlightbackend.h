@@ -0,0 +1,70 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGHIGHLIGHTBACKEND_H
+#define WINGHIGHLIGHTBACKEND_H
+
+#include "wingblockmetadata.h"
+
+#include <KSyntaxHighlighting/Definition>
+#include <KSyntaxHighlighting/FoldingRegion>
+
+#include <QSharedPointer>
+#include <QStringView>
+
+#include <functional>
+
+/**
+ * A purpose-built lexer highlighting one language instead of the rule
+ * interpreter of KSyntaxHighlighting. It is created for a definition and
+ * reports the format ids and folding regions of that definition, so the
+ * result is styled by the same theme formats.
+ *
+ * Backends are immutable once created and highlight lines from several
+ * threads at once.
+ */
+class WingHighlightBackend {
+public:
+    using Factory = std::function<QSharedPointer<const WingHighlightBackend>(
+        const KSyntaxHighlighting::Definition &)>;
+
+    virtual ~WingHighlightBackend();
+
+    virtual QString name() const = 0;
+
+    /** Highlights @p text from @p state, 0 being the state at the start of
+     *  a document, and returns the state at the end of the line. Format
+     *  runs and folding regions are appended to @p runs and @p regions.
+     */
+    virtual int
+    highlightLine(QStringView text, int state, QList<WingFormatRun> &runs,
+                  QList<KSyntaxHighlighting::FoldingRegion> &regions) const = 0;
+
+public:
+    /** Uses @p factory for the definition named @p definitionName. The
+     *  registry is meant to be set up on the GUI thread at startup.
+     */
+    static void registerBackend(const QString &definitionName,
+                                const Factory &factory);
+    static void unregisterBackend(const QString &definitionName);
+
+    /** Returns a backend for @p def or nullptr if none is registered or
+     *  the registered one cannot handle @p def.
+     */
+    static QSharedPointer<const WingHighlightBackend>
+    create(const KSyntaxHighlighting::Definition &def);
+};
+
+#endif // WINGHIGHLIGHTBACKEND_H
@@ -0,0 +1,126 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "winghighlightscheduler.h"
+#include "wingsyntaxhighlighter.h"
+
+#include <QTimer>
+
+WingHighlightScheduler &WingHighlightScheduler::instance() {
+    static WingHighlightScheduler ins;
+    return ins;
+}
+
+void WingHighlightScheduler::registerHighlighter(
+    WingSyntaxHighlighter *highlighter) {
+    _priorities.insert(highlighter, Priority::Visible);
+}
+
+void WingHighlightScheduler::unregisterHighlighter(
+    WingSyntaxHighlighter *highlighter) {
+    _priorities.remove(highlighter);
+    _queue.removeAll(highlighter);
+}
+
+void WingHighlightScheduler::setPriority(WingSyntaxHighlighter *highlighter,
+                                         Priority priority) {
+    auto it = _priorities.find(highlighter);
+    if (it == _priorities.end() || it.value() == priority) {
+        return;
+    }
+    it.value() = priority;
+    if (priority != Priority::Paused && _queue.contains(highlighter)) {
+        scheduleTurn();
+    }
+}
+
+WingHighlightScheduler::Priority
+WingHighlightScheduler::priority(WingSyntaxHighlighter *highlighter) const {
+    return _priorities.value(highlighter, Priority::Visible);
+}
+
+void WingHighlightScheduler::schedule(WingSyntaxHighlighter *highlighter) {
+    if (!_priorities.contains(highlighter)) {
+        return;
+    }
+    if (!_queue.contains(highlighter)) {
+        _queue.append(highlighter);
+    }
+    if (priority(highlighter) != Priority::Paused) {
+        scheduleTurn();
+    }
+}
+
+WingHighlightScheduler::WingHighlightScheduler() {}
+
+void WingHighlightScheduler::scheduleTurn() {
+    if (_turnScheduled) {
+        return;
+    }
+    _turnScheduled = true;
+    QTimer::singleShot(0, [this]() { runTurn(); });
+}
+
+void WingHighlightScheduler::runTurn() {
+    _turnScheduled = false;
+
+    auto queue = std::exchange(_queue, {});
+    std::stable_sort(queue.begin(), queue.end(),
+                     [this](WingSyntaxHighlighter *a, WingSyntaxHighlighter *b) {
+                         return priority(a) < priority(b);
+                     });
+
+    // highlighters queue themselves again while they have work left, the
+    // ones skipped this turn go in front of them
+    QList<WingSyntaxHighlighter *> skipped;
+    bool visibleWork = false;
+    bool backgroundWork = false;
+    for (auto highlighter : std::as_const(queue)) {
+        // unregistered by the work of another highlighter
+        if (!_priorities.contains(highlighter)) {
+            continue;
+        }
+
+        switch (priority(highlighter)) {
+        case Priority::Foreground:
+        case Priority::Visible:
+            visibleWork = true;
+            break;
+        case Priority::Background:
+            if (visibleWork || backgroundWork) {
+                skipped.append(highlighter);
+                continue;
+            }
+            backgroundWork = true;
+            break;
+        case Priority::Paused:
+            skipped.append(highlighter);
+            continue;
+        }
+        highlighter->processScheduledWork();
+    }
+
+    for (auto it = skipped.crbegin(); it != skipped.crend(); ++it) {
+        if (!_queue.contains(*it)) {
+            _queue.prepend(*it);
+        }
+    }
+    for (auto highlighter : std::as_const(_queue)) {
+        if (priority(highlighter) != Priority::Paused) {
+            scheduleTurn();
+            break;
+        }
+    }
+}
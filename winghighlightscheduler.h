@@ -0,0 +1,70 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGHIGHLIGHTSCHEDULER_H
+#define WINGHIGHLIGHTSCHEDULER_H
+
+#include <QHash>
+#include <QList>
+
+class WingSyntaxHighlighter;
+
+/**
+ * Runs the deferred highlighting work of every highlighter in the
+ * process, one turn per event loop iteration. Foreground and visible
+ * highlighters get a time slice every turn, background ones share a
+ * single slice in turns where no visible highlighter has work left,
+ * and paused ones get none until their priority rises again.
+ */
+class WingHighlightScheduler {
+    Q_DISABLE_COPY_MOVE(WingHighlightScheduler)
+public:
+    enum class Priority {
+        /** The editor with the keyboard focus */
+        Foreground,
+        /** Editors shown on the screen */
+        Visible,
+        /** Hidden editors, e.g. inactive tabs */
+        Background,
+        /** Editors whose window is minimized */
+        Paused
+    };
+
+    static WingHighlightScheduler &instance();
+
+public:
+    void registerHighlighter(WingSyntaxHighlighter *highlighter);
+    void unregisterHighlighter(WingSyntaxHighlighter *highlighter);
+
+    void setPriority(WingSyntaxHighlighter *highlighter, Priority priority);
+    Priority priority(WingSyntaxHighlighter *highlighter) const;
+
+    /** Queues @p highlighter for the next turn */
+    void schedule(WingSyntaxHighlighter *highlighter);
+
+private:
+    WingHighlightScheduler();
+
+    void scheduleTurn();
+    void runTurn();
+
+private:
+    QHash<WingSyntaxHighlighter *, Priority> _priorities;
+    // highlighters with work left, background ones in round-robin order
+    QList<WingSyntaxHighlighter *> _queue;
+    bool _turnScheduled = false;
+};
+
+#endif // WINGHIGHLIGHTSCHEDULER_H
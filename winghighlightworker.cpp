@@ -0,0 +1,377 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "winghighlightworker.h"
+#include "definition_p.h"
+
+#include <KSyntaxHighlighting/AbstractHighlighter>
+#include <KSyntaxHighlighting/Format>
+#include <KSyntaxHighlighting/Repository>
+#include <QCryptographicHash>
+#include <QMutex>
+#include <QPromise>
+#include <QScopeGuard>
+#include <QThread>
+#include <QtConcurrent>
+
+#include <memory>
+#include <unordered_map>
+
+using namespace KSyntaxHighlighting;
+
+class WingLineHighlighter : public AbstractHighlighter {
+public:
+    explicit WingLineHighlighter(const Definition &def) { setDefinition(def); }
+
+    State highlight(const QString &text, const State &state,
+                    WingHighlightLine &line) {
+        m_line = &line;
+        auto newState = highlightLine(text, state);
+        m_line = nullptr;
+        return newState;
+    }
+
+protected:
+    void applyFormat(int offset, int length, const Format &format) override {
+        if (length == 0) {
+            return;
+        }
+        m_line->runs.append({offset, length, format.id()});
+    }
+
+    void applyFolding(int offset, int length, FoldingRegion region) override {
+        Q_UNUSED(offset);
+        Q_UNUSED(length);
+        WingHighlightWorker::appendFoldingRegion(m_line->foldingRegions,
+                                                 region);
+    }
+
+private:
+    WingHighlightLine *m_line = nullptr;
+};
+
+static WingHighlightLine highlightJobLine(WingLineHighlighter &highlighter,
+                                          const WingHighlightJob &job,
+                                          const WingHighlightJob::Line &src,
+                                          State &state, int &stateId) {
+    const auto &text = src.text;
+    WingHighlightLine line;
+    line.textHash = qHash(text);
+    line.plain = (job.maxLineLength > 0 && text.size() > job.maxLineLength) ||
+                 job.plainLines.contains(text, line.textHash);
+    if (!line.plain) {
+        if (job.backend) {
+            stateId = job.backend->highlightLine(text, stateId, line.runs,
+                                                 line.foldingRegions);
+        } else {
+            QMutexLocker locker(
+                &WingHighlightWorker::definitionLock(job.definition));
+            state = highlighter.highlight(text, state, line);
+        }
+        WingHighlightWorker::compactRuns(line.runs, text);
+    } else if (src.highlighted) {
+        // keep the end state the line had before it turned plain
+        state = src.state;
+        stateId = src.stateId;
+    }
+    line.state = state;
+    line.stateId = stateId;
+    return line;
+}
+
+static bool sameState(const WingHighlightLine &lhs,
+                      const WingHighlightLine &rhs) {
+    return lhs.stateId == rhs.stateId && lhs.state == rhs.state;
+}
+
+// lines [begin, end) highlighted from a guessed incoming state
+static WingHighlightBatch highlightChunk(QPromise<WingHighlightBatch> &promise,
+                                         const WingHighlightJob &job,
+                                         qsizetype begin, qsizetype end) {
+    WingLineHighlighter highlighter(job.definition);
+    State state;
+    int stateId = 0;
+    WingHighlightBatch lines;
+    lines.reserve(end - begin);
+    for (auto i = begin; i < end; ++i) {
+        if (promise.isCanceled()) {
+            return {};
+        }
+        lines.append(highlightJobLine(highlighter, job, job.lines.at(i), state,
+                                      stateId));
+    }
+    return lines;
+}
+
+static int speculativeChunks(const WingHighlightJob &job) {
+    // chunks of the rule interpreter would only take turns on the
+    // repository lock, see SpeculativeChunkLines; and only a first pass
+    // has no highlighted tail to converge with
+    const auto total = job.lines.size();
+    if (!job.backend || total == 0 || !job.lines.last().pending) {
+        return 1;
+    }
+    return int(qBound<qsizetype>(
+        1, total / WingHighlightWorker::SpeculativeChunkLines,
+        QThread::idealThreadCount()));
+}
+
+static void highlightSpeculatively(QPromise<WingHighlightBatch> &promise,
+                                   const WingHighlightJob &job, int chunks) {
+    const auto total = job.lines.size();
+    const auto chunkLines = (total + chunks - 1) / chunks;
+
+    QList<QFuture<WingHighlightBatch>> guesses;
+    const auto waitForGuesses = qScopeGuard([&guesses]() {
+        for (auto &guess : guesses) {
+            guess.waitForFinished();
+        }
+    });
+    for (auto begin = chunkLines; begin < total; begin += chunkLines) {
+        const auto end = qMin(total, begin + chunkLines);
+        guesses.append(QtConcurrent::run([&promise, &job, begin, end]() {
+            return highlightChunk(promise, job, begin, end);
+        }));
+    }
+
+    WingLineHighlighter highlighter(job.definition);
+    auto state = job.state;
+    auto stateId = job.stateId;
+    WingHighlightBatch batch;
+    const auto append = [&promise, &batch](WingHighlightLine &&line) {
+        batch.append(std::move(line));
+        if (batch.size() >= WingHighlightWorker::BatchSize) {
+            promise.addResult(std::move(batch));
+            batch = WingHighlightBatch();
+        }
+    };
+
+    for (qsizetype i = 0; i < chunkLines; ++i) {
+        if (promise.isCanceled()) {
+            return;
+        }
+        append(highlightJobLine(highlighter, job, job.lines.at(i), state,
+                                stateId));
+    }
+
+    // each chunk is redone from its real incoming state until an end state
+    // matches the guessed one, the guess is right from there on
+    auto first = chunkLines;
+    for (auto &guess : guesses) {
+        auto lines = guess.result();
+        if (promise.isCanceled()) {
+            return;
+        }
+
+        qsizetype i = 0;
+        while (i < lines.size()) {
+            if (promise.isCanceled()) {
+                return;
+            }
+            auto line =
+                highlightJobLine(highlighter, job, job.lines.at(first + i),
+                                 state, stateId);
+            const bool converged = sameState(line, lines.at(i));
+            append(std::move(line));
+            ++i;
+            if (converged) {
+                break;
+            }
+        }
+        for (; i < lines.size(); ++i) {
+            state = lines.at(i).state;
+            stateId = lines.at(i).stateId;
+            append(std::move(lines[i]));
+        }
+        first += lines.size();
+    }
+
+    if (!batch.isEmpty()) {
+        promise.addResult(std::move(batch));
+    }
+}
+
+static void highlightJob(QPromise<WingHighlightBatch> &promise,
+                         const WingHighlightJob &job) {
+    const int chunks = speculativeChunks(job);
+    if (chunks > 1) {
+        highlightSpeculatively(promise, job, chunks);
+        return;
+    }
+
+    WingLineHighlighter highlighter(job.definition);
+
+    auto state = job.state;
+    auto stateId = job.stateId;
+    WingHighlightBatch batch;
+    const auto total = job.lines.size();
+    for (qsizetype i = 0; i < total; ++i) {
+        if (promise.isCanceled()) {
+            return;
+        }
+
+        const auto &src = job.lines.at(i);
+        batch.append(
+            highlightJobLine(highlighter, job, src, state, stateId));
+
+        // the next line was highlighted from this very state before,
+        // so everything from here on is still up to date
+        const bool converged = i + 1 < total && !job.lines.at(i + 1).pending &&
+                               state == src.state && stateId == src.stateId;
+        if (converged || batch.size() >= WingHighlightWorker::BatchSize) {
+            promise.addResult(std::move(batch));
+            batch = WingHighlightBatch();
+        }
+        if (converged) {
+            return;
+        }
+    }
+
+    if (!batch.isEmpty()) {
+        promise.addResult(std::move(batch));
+    }
+}
+
+void WingPlainLines::insert(const QString &text, size_t textHash) {
+    if (!contains(text, textHash)) {
+        m_digests.insert(textHash, digest(text));
+    }
+}
+
+bool WingPlainLines::contains(const QString &text, size_t textHash) const {
+    auto it = m_digests.constFind(textHash);
+    if (it == m_digests.cend()) {
+        return false;
+    }
+    const auto textDigest = digest(text);
+    for (; it != m_digests.cend() && it.key() == textHash; ++it) {
+        if (*it == textDigest) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void WingPlainLines::clear() { m_digests.clear(); }
+
+QByteArray WingPlainLines::digest(const QString &text) {
+    return QCryptographicHash::hash(
+        QByteArrayView(reinterpret_cast<const char *>(text.utf16()),
+                       text.size() * qsizetype(sizeof(char16_t))),
+        QCryptographicHash::Sha1);
+}
+
+QFuture<WingHighlightBatch>
+WingHighlightWorker::run(const WingHighlightJob &job) {
+    return QtConcurrent::run(highlightJob, job);
+}
+
+QMutex &WingHighlightWorker::definitionLock(const Definition &def) {
+    return repositoryLock(DefinitionData::get(def)->repo);
+}
+
+QMutex &WingHighlightWorker::repositoryLock(const Repository *repo) {
+    // repositories live as long as the application, so do their locks
+    static QMutex mutex;
+    static std::unordered_map<const Repository *,
+                              std::unique_ptr<QMutex>>
+        locks;
+    QMutexLocker locker(&mutex);
+    auto &lock = locks[repo];
+    if (!lock) {
+        lock = std::make_unique<QMutex>();
+    }
+    return *lock;
+}
+
+void WingHighlightWorker::loadDefinition(const Definition &def) {
+    QMutexLocker locker(&definitionLock(def));
+    def.includedDefinitions();
+}
+
+Definition WingHighlightWorker::loadDefinition(Repository *repo,
+                                               const QString &name) {
+    QMutexLocker locker(&repositoryLock(repo));
+    auto def = repo->definitionForName(name);
+    def.includedDefinitions();
+    return def;
+}
+
+void WingHighlightWorker::compactRuns(QList<WingFormatRun> &runs,
+                                      QStringView text) {
+    QList<WingFormatRun> compacted;
+    compacted.reserve(runs.size());
+
+    const auto append = [&compacted](qsizetype begin, qsizetype end,
+                                     int formatId) {
+        if (!compacted.isEmpty()) {
+            auto &last = compacted.last();
+            if (last.formatId == formatId && last.offset + last.length == begin) {
+                last.length += int(end - begin);
+                return;
+            }
+        }
+        compacted.append({int(begin), int(end - begin), formatId});
+    };
+
+    // text no token covers keeps the default format apart from whitespace
+    const auto appendSpan = [&](qsizetype begin, qsizetype end, int formatId) {
+        while (begin < end) {
+            const bool space = text.at(begin).isSpace();
+            auto next = begin + 1;
+            while (next < end && text.at(next).isSpace() == space) {
+                ++next;
+            }
+            if (space) {
+                append(begin, next, WingFormatRun::WhitespaceFormat);
+            } else if (formatId != WingFormatRun::WhitespaceFormat) {
+                append(begin, next, formatId);
+            }
+            begin = next;
+        }
+    };
+
+    qsizetype pos = 0;
+    for (const auto &run : std::as_const(runs)) {
+        const auto begin = qBound(pos, qsizetype(run.offset), text.size());
+        const auto end = qBound(begin, qsizetype(run.offset) + run.length,
+                                text.size());
+        appendSpan(pos, begin, WingFormatRun::WhitespaceFormat);
+        appendSpan(begin, end, run.formatId);
+        pos = end;
+    }
+    appendSpan(pos, text.size(), WingFormatRun::WhitespaceFormat);
+
+    runs = std::move(compacted);
+}
+
+void WingHighlightWorker::appendFoldingRegion(QList<FoldingRegion> &regions,
+                                              FoldingRegion region) {
+    if (region.type() == FoldingRegion::Begin) {
+        regions.push_back(region);
+    }
+
+    if (region.type() == FoldingRegion::End) {
+        for (int i = regions.size() - 1; i >= 0; --i) {
+            if (regions.at(i).id() != region.id() ||
+                regions.at(i).type() != FoldingRegion::Begin) {
+                continue;
+            }
+            regions.remove(i);
+            return;
+        }
+        regions.push_back(region);
+    }
+}
@@ -0,0 +1,151 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGHIGHLIGHTWORKER_H
+#define WINGHIGHLIGHTWORKER_H
+
+#include "wingblockmetadata.h"
+#include "winghighlightbackend.h"
+
+#include <KSyntaxHighlighting/Definition>
+#include <KSyntaxHighlighting/FoldingRegion>
+#include <KSyntaxHighlighting/State>
+
+namespace KSyntaxHighlighting {
+class Repository;
+} // namespace KSyntaxHighlighting
+
+#include <QFuture>
+#include <QList>
+#include <QMultiHash>
+#include <QMutex>
+#include <QString>
+#include <QStringView>
+
+struct WingHighlightLine {
+    QList<WingFormatRun> runs;
+    QList<KSyntaxHighlighting::FoldingRegion> foldingRegions;
+    KSyntaxHighlighting::State state;
+    int stateId = 0;
+    size_t textHash = 0;
+    bool plain = false;
+};
+
+using WingHighlightBatch = QList<WingHighlightLine>;
+
+/**
+ * Lines shown plain, by text. The lines are too long to keep, so a hit on
+ * the text hash is confirmed by a SHA-1 digest of the text.
+ */
+class WingPlainLines {
+public:
+    void insert(const QString &text, size_t textHash);
+    bool contains(const QString &text, size_t textHash) const;
+    void clear();
+
+private:
+    static QByteArray digest(const QString &text);
+
+private:
+    QMultiHash<size_t, QByteArray> m_digests;
+};
+
+/**
+ * An immutable snapshot of consecutive blocks handed to the worker.
+ * Every line carries the end state it was highlighted with last time,
+ * so the worker can stop as soon as the highlighting converges.
+ * A snapshot of nothing but pending lines is a first pass, which a
+ * backend splits into chunks highlighted in parallel, see
+ * SpeculativeChunkLines.
+ */
+struct WingHighlightJob {
+    struct Line {
+        QString text;
+        KSyntaxHighlighting::State state;
+        int stateId;
+        bool pending;
+        /** state and stateId are a real end state */
+        bool highlighted;
+    };
+
+    KSyntaxHighlighting::Definition definition;
+    KSyntaxHighlighting::State state;
+    QList<Line> lines;
+
+    /** highlights instead of the definition if set; a backend only uses
+     *  the state ids, the definition only the states */
+    QSharedPointer<const WingHighlightBackend> backend;
+    int stateId = 0;
+
+    /** lines longer than this, or among these plain lines, are
+     *  passed through unhighlighted */
+    qsizetype maxLineLength = 0;
+    WingPlainLines plainLines;
+};
+
+class WingHighlightWorker {
+public:
+    static constexpr int BatchSize = 256;
+
+    /** First passes through a backend are split into chunks of at least
+     *  this many lines. All but the first chunk start from the initial
+     *  state and are redone from their real incoming state until the end
+     *  states agree with the guessed ones.
+     *  Definitions run by the rule interpreter are never split: every
+     *  line holds definitionLock() exclusively, so their chunks would
+     *  run one after another and only add the redone lines.
+     */
+    static constexpr int SpeculativeChunkLines = 2048;
+
+    /** Highlights @p job on the global thread pool. Results are reported
+     *  in batches of at most BatchSize lines, in document order.
+     */
+    static QFuture<WingHighlightBatch> run(const WingHighlightJob &job);
+
+    /** Definitions are loaded lazily, and their rules are resolved on
+     *  first use even while highlighting, so neither is thread-safe.
+     *  Loading a definition and every highlightLine() call on it hold
+     *  this lock. Included definitions and format ids are shared by all
+     *  definitions of a repository, so there is one lock per repository.
+     */
+    static QMutex &
+    definitionLock(const KSyntaxHighlighting::Definition &def);
+    static QMutex &
+    repositoryLock(const KSyntaxHighlighting::Repository *repo);
+
+    /** Loads @p def and everything it includes, so it is only read while
+     *  lines are highlighted with it.
+     */
+    static void loadDefinition(const KSyntaxHighlighting::Definition &def);
+
+    /** Looks up the definition @p name in @p repo and loads it, all under
+     *  the lock of @p repo, so it can be called from any thread.
+     */
+    static KSyntaxHighlighting::Definition
+    loadDefinition(KSyntaxHighlighting::Repository *repo,
+                   const QString &name);
+
+    /** Merges adjacent runs of the same format and splits the whitespace
+     *  of @p text off into WingFormatRun::WhitespaceFormat runs, so a line
+     *  is styled with as few setFormat() calls as possible.
+     */
+    static void compactRuns(QList<WingFormatRun> &runs, QStringView text);
+
+    static void appendFoldingRegion(
+        QList<KSyntaxHighlighting::FoldingRegion> &regions,
+        KSyntaxHighlighting::FoldingRegion region);
+};
+
+#endif // WINGHIGHLIGHTWORKER_H
@@ -0,0 +1,524 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "wingjsonlexer.h"
+#include "winghighlightworker.h"
+
+#include <KSyntaxHighlighting/AbstractHighlighter>
+#include <KSyntaxHighlighting/Format>
+#include <KSyntaxHighlighting/Theme>
+#include <QVarLengthArray>
+
+using namespace KSyntaxHighlighting;
+
+namespace {
+
+enum CharClass : quint8 {
+    OtherChar,
+    SpaceChar,
+    QuoteChar,
+    BackslashChar,
+    DigitChar,
+    MinusChar,
+    PlusChar,
+    DotChar,
+    ExponentChar, // e E
+    HexLetterChar, // a-d f A-D F
+    LetterUChar,
+    LetterChar,
+    PunctuationChar, // { } [ ] , :
+    SlashChar,
+    StarChar,
+    CharClassCount
+};
+
+enum Token : quint8 {
+    NoToken,
+    SpaceToken,
+    PunctuationToken,
+    IntegerToken,
+    FloatToken,
+    WordToken,
+    StringOpenToken,
+    StringTextToken,
+    EscapeToken,
+    StringCloseToken,
+    LineCommentToken,
+    CommentOpenToken,
+    CommentTextToken,
+    CommentCloseToken,
+    ErrorToken
+};
+
+enum DfaState : quint8 {
+    Dead,
+    // tokens outside strings and comments
+    NormalStart,
+    SpaceRun,
+    Punctuation,
+    NumberMinus,
+    NumberInteger,
+    NumberDot,
+    NumberFraction,
+    NumberExponent,
+    NumberExponentSign,
+    NumberExponentDigits,
+    Word,
+    StringOpen,
+    CommentSlash,
+    LineComment,
+    CommentOpen,
+    ErrorChar,
+    // tokens inside a string
+    StringStart,
+    StringText,
+    EscapeStart,
+    Escape,
+    EscapeHex0,
+    EscapeHex1,
+    EscapeHex2,
+    EscapeHex3,
+    EscapeUnicode,
+    StringClose,
+    // tokens inside a block comment
+    CommentStart,
+    CommentText,
+    CommentStar,
+    CommentClose,
+    DfaStateCount
+};
+
+struct Dfa {
+    quint8 next[DfaStateCount][CharClassCount] = {};
+    Token accepts[DfaStateCount] = {};
+};
+
+constexpr Dfa buildDfa() {
+    Dfa dfa;
+    const auto on = [&dfa](DfaState from, std::initializer_list<CharClass> cs,
+                           DfaState to) {
+        for (auto c : cs) {
+            dfa.next[from][c] = to;
+        }
+    };
+    const auto onAny = [&dfa](DfaState from, DfaState to) {
+        for (int c = 0; c < CharClassCount; ++c) {
+            dfa.next[from][c] = to;
+        }
+    };
+    const std::initializer_list<CharClass> letters = {
+        ExponentChar, HexLetterChar, LetterUChar, LetterChar};
+    const std::initializer_list<CharClass> hexDigits = {
+        DigitChar, ExponentChar, HexLetterChar};
+
+    onAny(NormalStart, ErrorChar);
+    on(NormalStart, {SpaceChar}, SpaceRun);
+    on(NormalStart, {PunctuationChar}, Punctuation);
+    on(NormalStart, {MinusChar}, NumberMinus);
+    on(NormalStart, {DigitChar}, NumberInteger);
+    on(NormalStart, letters, Word);
+    on(NormalStart, {QuoteChar}, StringOpen);
+    on(NormalStart, {SlashChar}, CommentSlash);
+
+    on(SpaceRun, {SpaceChar}, SpaceRun);
+    on(NumberMinus, {DigitChar}, NumberInteger);
+    on(NumberInteger, {DigitChar}, NumberInteger);
+    on(NumberInteger, {DotChar}, NumberDot);
+    on(NumberInteger, {ExponentChar}, NumberExponent);
+    on(NumberDot, {DigitChar}, NumberFraction);
+    on(NumberFraction, {DigitChar}, NumberFraction);
+    on(NumberFraction, {ExponentChar}, NumberExponent);
+    on(NumberExponent, {MinusChar, PlusChar}, NumberExponentSign);
+    on(NumberExponent, {DigitChar}, NumberExponentDigits);
+    on(NumberExponentSign, {DigitChar}, NumberExponentDigits);
+    on(NumberExponentDigits, {DigitChar}, NumberExponentDigits);
+    on(Word, letters, Word);
+    on(Word, {DigitChar}, Word);
+    on(CommentSlash, {SlashChar}, LineComment);
+    on(CommentSlash, {StarChar}, CommentOpen);
+    onAny(LineComment, LineComment);
+
+    onAny(StringStart, StringText);
+    on(StringStart, {QuoteChar}, StringClose);
+    on(StringStart, {BackslashChar}, EscapeStart);
+    onAny(StringText, StringText);
+    on(StringText, {QuoteChar, BackslashChar}, Dead);
+    onAny(EscapeStart, Escape);
+    on(EscapeStart, {LetterUChar}, EscapeHex0);
+    on(EscapeHex0, hexDigits, EscapeHex1);
+    on(EscapeHex1, hexDigits, EscapeHex2);
+    on(EscapeHex2, hexDigits, EscapeHex3);
+    on(EscapeHex3, hexDigits, EscapeUnicode);
+
+    onAny(CommentStart, CommentText);
+    on(CommentStart, {StarChar}, CommentStar);
+    onAny(CommentText, CommentText);
+    on(CommentText, {StarChar}, CommentStar);
+    onAny(CommentStar, CommentText);
+    on(CommentStar, {StarChar}, CommentStar);
+    on(CommentStar, {SlashChar}, CommentClose);
+
+    dfa.accepts[SpaceRun] = SpaceToken;
+    dfa.accepts[Punctuation] = PunctuationToken;
+    dfa.accepts[NumberInteger] = IntegerToken;
+    dfa.accepts[NumberFraction] = FloatToken;
+    dfa.accepts[NumberExponentDigits] = FloatToken;
+    dfa.accepts[Word] = WordToken;
+    dfa.accepts[StringOpen] = StringOpenToken;
+    dfa.accepts[LineComment] = LineCommentToken;
+    dfa.accepts[CommentOpen] = CommentOpenToken;
+    dfa.accepts[ErrorChar] = ErrorToken;
+    dfa.accepts[StringText] = StringTextToken;
+    dfa.accepts[Escape] = EscapeToken;
+    dfa.accepts[EscapeUnicode] = EscapeToken;
+    dfa.accepts[StringClose] = StringCloseToken;
+    dfa.accepts[CommentText] = CommentTextToken;
+    dfa.accepts[CommentStar] = CommentTextToken;
+    dfa.accepts[CommentClose] = CommentCloseToken;
+    return dfa;
+}
+
+constexpr Dfa dfa = buildDfa();
+
+constexpr std::array<CharClass, 128> buildCharClasses() {
+    std::array<CharClass, 128> classes = {};
+    for (auto c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+        classes[c] = SpaceChar;
+    }
+    for (auto c = '0'; c <= '9'; ++c) {
+        classes[c] = DigitChar;
+    }
+    for (auto c = 'a'; c <= 'z'; ++c) {
+        classes[c] = LetterChar;
+        classes[c - 'a' + 'A'] = LetterChar;
+    }
+    for (auto c : {'a', 'b', 'c', 'd', 'f', 'A', 'B', 'C', 'D', 'F'}) {
+        classes[c] = HexLetterChar;
+    }
+    for (auto c : {'{', '}', '[', ']', ',', ':'}) {
+        classes[c] = PunctuationChar;
+    }
+    classes['_'] = LetterChar;
+    classes['e'] = classes['E'] = ExponentChar;
+    classes['u'] = LetterUChar;
+    classes['"'] = QuoteChar;
+    classes['\\'] = BackslashChar;
+    classes['-'] = MinusChar;
+    classes['+'] = PlusChar;
+    classes['.'] = DotChar;
+    classes['/'] = SlashChar;
+    classes['*'] = StarChar;
+    return classes;
+}
+
+constexpr auto charClasses = buildCharClasses();
+
+inline CharClass charClass(QChar ch) {
+    const auto u = ch.unicode();
+    if (u < charClasses.size()) {
+        return charClasses[u];
+    }
+    return ch.isSpace() ? SpaceChar : OtherChar;
+}
+
+enum Mode { NormalMode, StringMode, CommentMode };
+
+constexpr DfaState startState(Mode mode) {
+    switch (mode) {
+    case StringMode:
+        return StringStart;
+    case CommentMode:
+        return CommentStart;
+    default:
+        return NormalStart;
+    }
+}
+
+// the folding regions the rule interpreter reports for a sample line
+class SampleHighlighter : public AbstractHighlighter {
+public:
+    explicit SampleHighlighter(const Definition &def) { setDefinition(def); }
+
+    void highlight(const QString &text) { highlightLine(text, State()); }
+
+    QList<std::pair<int, FoldingRegion>> regions;
+
+protected:
+    void applyFormat(int offset, int length, const Format &format) override {
+        Q_UNUSED(offset);
+        Q_UNUSED(length);
+        Q_UNUSED(format);
+    }
+
+    void applyFolding(int offset, int length, FoldingRegion region) override {
+        Q_UNUSED(length);
+        regions.append({offset, region});
+    }
+};
+
+int formatForName(const QList<Format> &formats, QStringView name) {
+    for (const auto &format : formats) {
+        if (format.name() == name) {
+            return format.id();
+        }
+    }
+    return -1;
+}
+
+int formatForStyle(const QList<Format> &formats, Theme::TextStyle style) {
+    for (const auto &format : formats) {
+        if (format.textStyle() == style) {
+            return format.id();
+        }
+    }
+    return -1;
+}
+
+} // namespace
+
+WingJsonLexer::WingJsonLexer(const Definition &def) {
+    // folding regions have no name lookup, the sample opens and closes
+    // an object and an array
+    const auto sample = QStringLiteral(R"({"k":[]})");
+    SampleHighlighter highlighter(def);
+    QList<Format> formats;
+    {
+        QMutexLocker locker(&WingHighlightWorker::definitionLock(def));
+        formats = def.formats();
+        highlighter.highlight(sample);
+    }
+
+    // the item data of json.xml
+    const auto formatId = [&formats](const char16_t *name) {
+        return formatForName(formats, name);
+    };
+    m_formats[ObjectFormat] = formatId(u"Style_Seperator_Pair");
+    m_formats[PairSeparatorFormat] = m_formats[ObjectFormat];
+    m_formats[ArrayFormat] = formatId(u"Style_Seperator_Array");
+    m_formats[ArraySeparatorFormat] = m_formats[ArrayFormat];
+    m_formats[KeyFormat] = formatId(u"Style_String_Key");
+    m_formats[ValueFormat] = formatId(u"Style_String_Value");
+    m_formats[IntegerFormat] = formatId(u"Style_Decimal");
+    m_formats[FloatFormat] = formatId(u"Style_Float");
+    m_formats[KeywordFormat] = formatId(u"Style_Keyword");
+
+    // optional, older definitions style these with their string or not
+    m_formats[KeyEscapeFormat] = formatId(u"Style_String_Key_Char");
+    if (m_formats[KeyEscapeFormat] < 0) {
+        m_formats[KeyEscapeFormat] = m_formats[KeyFormat];
+    }
+    m_formats[ValueEscapeFormat] = formatId(u"Style_String_Value_Char");
+    if (m_formats[ValueEscapeFormat] < 0) {
+        m_formats[ValueEscapeFormat] = m_formats[ValueFormat];
+    }
+    m_formats[CommentFormat] = formatId(u"Style_Comment");
+    if (m_formats[CommentFormat] < 0) {
+        m_formats[CommentFormat] = formatForStyle(formats, Theme::Comment);
+    }
+    m_formats[ErrorFormat] = formatId(u"Style_Error");
+    if (m_formats[ErrorFormat] < 0) {
+        m_formats[ErrorFormat] = formatForStyle(formats, Theme::Error);
+    }
+
+    for (const auto &[offset, region] : std::as_const(highlighter.regions)) {
+        switch (sample.at(offset).unicode()) {
+        case u'{':
+            m_objectBegin = region;
+            break;
+        case u'[':
+            m_arrayBegin = region;
+            break;
+        case u']':
+            m_arrayEnd = region;
+            break;
+        case u'}':
+            m_objectEnd = region;
+            break;
+        }
+    }
+}
+
+bool WingJsonLexer::isComplete() const {
+    for (const auto format :
+         {ObjectFormat, ArrayFormat, KeyFormat, ValueFormat, IntegerFormat,
+          FloatFormat, KeywordFormat}) {
+        if (m_formats[format] < 0) {
+            return false;
+        }
+    }
+    for (const auto &region :
+         {m_objectBegin, m_objectEnd, m_arrayBegin, m_arrayEnd}) {
+        if (region.type() == FoldingRegion::None) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QSharedPointer<const WingHighlightBackend>
+WingJsonLexer::create(const Definition &def) {
+    QSharedPointer<const WingJsonLexer> lexer(new WingJsonLexer(def));
+    // a definition this lexer does not know is left to the rule interpreter
+    if (!lexer->isComplete()) {
+        return {};
+    }
+    return lexer;
+}
+
+QString WingJsonLexer::name() const { return QStringLiteral("JSON DFA"); }
+
+int WingJsonLexer::highlightLine(QStringView text, int state,
+                                 QList<WingFormatRun> &runs,
+                                 QList<FoldingRegion> &regions) const {
+    const auto append = [&runs](qsizetype begin, qsizetype end, int format) {
+        if (format >= 0 && end > begin) {
+            runs.append({int(begin), int(end - begin), format});
+        }
+    };
+    const auto fold = [&regions](const FoldingRegion &region) {
+        if (region.type() != FoldingRegion::None) {
+            WingHighlightWorker::appendFoldingRegion(regions, region);
+        }
+    };
+
+    // a string is a key if a colon follows, which is only known at its end
+    struct StringPiece {
+        qsizetype begin;
+        qsizetype end;
+        bool escape;
+    };
+    QVarLengthArray<StringPiece, 8> pieces;
+    const auto appendString = [&](qsizetype end) {
+        qsizetype next = end;
+        while (next < text.size() && charClass(text.at(next)) == SpaceChar) {
+            ++next;
+        }
+        const bool key = next < text.size() && text.at(next) == u':';
+        for (const auto &piece : std::as_const(pieces)) {
+            const auto format =
+                piece.escape ? (key ? KeyEscapeFormat : ValueEscapeFormat)
+                             : (key ? KeyFormat : ValueFormat);
+            append(piece.begin, piece.end, m_formats[format]);
+        }
+        pieces.clear();
+    };
+
+    auto mode = state == InComment ? CommentMode : NormalMode;
+    qsizetype pos = 0;
+    while (pos < text.size()) {
+        // longest match
+        quint8 s = startState(mode);
+        Token token = NoToken;
+        qsizetype end = pos + 1;
+        for (auto i = pos; i < text.size(); ++i) {
+            s = dfa.next[s][charClass(text.at(i))];
+            if (s == Dead) {
+                break;
+            }
+            if (dfa.accepts[s] != NoToken) {
+                token = dfa.accepts[s];
+                end = i + 1;
+            }
+        }
+        if (token == NoToken) {
+            // a broken escape or anything no token starts with
+            token = mode == StringMode ? StringTextToken : ErrorToken;
+        }
+
+        switch (token) {
+        case PunctuationToken:
+            switch (text.at(pos).unicode()) {
+            case u'{':
+                append(pos, end, m_formats[ObjectFormat]);
+                fold(m_objectBegin);
+                break;
+            case u'}':
+                append(pos, end, m_formats[ObjectFormat]);
+                fold(m_objectEnd);
+                break;
+            case u'[':
+                append(pos, end, m_formats[ArrayFormat]);
+                fold(m_arrayBegin);
+                break;
+            case u']':
+                append(pos, end, m_formats[ArrayFormat]);
+                fold(m_arrayEnd);
+                break;
+            case u':':
+                append(pos, end, m_formats[PairSeparatorFormat]);
+                break;
+            default:
+                append(pos, end, m_formats[ArraySeparatorFormat]);
+                break;
+            }
+            break;
+        case IntegerToken:
+            append(pos, end, m_formats[IntegerFormat]);
+            break;
+        case FloatToken:
+            append(pos, end, m_formats[FloatFormat]);
+            break;
+        case WordToken: {
+            const auto word = text.mid(pos, end - pos);
+            const bool keyword = word == u"true" || word == u"false" ||
+                                 word == u"null";
+            append(pos, end, m_formats[keyword ? KeywordFormat : ErrorFormat]);
+            break;
+        }
+        case StringOpenToken:
+            mode = StringMode;
+            pieces.append({pos, end, false});
+            break;
+        case StringTextToken:
+            pieces.append({pos, end, false});
+            break;
+        case EscapeToken:
+            pieces.append({pos, end, true});
+            break;
+        case StringCloseToken:
+            mode = NormalMode;
+            pieces.append({pos, end, false});
+            appendString(end);
+            break;
+        case LineCommentToken:
+            append(pos, end, m_formats[CommentFormat]);
+            break;
+        case CommentOpenToken:
+            mode = CommentMode;
+            append(pos, end, m_formats[CommentFormat]);
+            break;
+        case CommentTextToken:
+            append(pos, end, m_formats[CommentFormat]);
+            break;
+        case CommentCloseToken:
+            mode = NormalMode;
+            append(pos, end, m_formats[CommentFormat]);
+            break;
+        case ErrorToken:
+            append(pos, end, m_formats[ErrorFormat]);
+            break;
+        case SpaceToken:
+        case NoToken:
+            break;
+        }
+        pos = end;
+    }
+
+    // strings do not continue on the next line
+    if (mode == StringMode) {
+        appendString(text.size());
+    }
+    return mode == CommentMode ? InComment : Initial;
+}
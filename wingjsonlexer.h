@@ -0,0 +1,74 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGJSONLEXER_H
+#define WINGJSONLEXER_H
+
+#include "winghighlightbackend.h"
+
+#include <array>
+
+/**
+ * Table-driven DFA lexer for JSON, plus comments as found in JSON with
+ * comments. The format ids are looked up by the item data names of the
+ * JSON definition and the folding regions taken from what it reports for
+ * a sample document, so both backends style a document the same. create()
+ * returns nullptr for a definition missing any of them.
+ */
+class WingJsonLexer : public WingHighlightBackend {
+public:
+    enum State { Initial = 0, InComment = 1 };
+
+    static QSharedPointer<const WingHighlightBackend>
+    create(const KSyntaxHighlighting::Definition &def);
+
+public:
+    QString name() const override;
+
+    int highlightLine(
+        QStringView text, int state, QList<WingFormatRun> &runs,
+        QList<KSyntaxHighlighting::FoldingRegion> &regions) const override;
+
+private:
+    explicit WingJsonLexer(const KSyntaxHighlighting::Definition &def);
+
+    bool isComplete() const;
+
+private:
+    enum Format {
+        ObjectFormat,
+        ArrayFormat,
+        PairSeparatorFormat,
+        ArraySeparatorFormat,
+        KeyFormat,
+        KeyEscapeFormat,
+        ValueFormat,
+        ValueEscapeFormat,
+        IntegerFormat,
+        FloatFormat,
+        KeywordFormat,
+        CommentFormat,
+        ErrorFormat,
+        FormatCount
+    };
+
+    std::array<int, FormatCount> m_formats;
+    KSyntaxHighlighting::FoldingRegion m_objectBegin;
+    KSyntaxHighlighting::FoldingRegion m_objectEnd;
+    KSyntaxHighlighting::FoldingRegion m_arrayBegin;
+    KSyntaxHighlighting::FoldingRegion m_arrayEnd;
+};
+
+#endif // WINGJSONLEXER_H
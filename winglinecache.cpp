@@ -0,0 +1,56 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "winglinecache.h"
+
+WingLineCache::WingLineCache(int lines) : m_cache(lines) {}
+
+const WingLineCacheEntry *WingLineCache::find(const WingLineCacheKey &key,
+                                              const QString &text) {
+    // a hash collision must not replay the formats of another line
+    auto entry = m_cache.object(key);
+    if (entry && entry->text != text) {
+        entry = nullptr;
+    }
+    if (entry) {
+        ++m_hits;
+    } else {
+        ++m_misses;
+    }
+    return entry;
+}
+
+void WingLineCache::insert(const WingLineCacheKey &key,
+                           WingLineCacheEntry entry) {
+    if (m_cache.maxCost() > 0) {
+        m_cache.insert(key, new WingLineCacheEntry(std::move(entry)));
+    }
+}
+
+void WingLineCache::clear() { m_cache.clear(); }
+
+void WingLineCache::setCapacity(int lines) { m_cache.setMaxCost(lines); }
+
+int WingLineCache::capacity() const { return m_cache.maxCost(); }
+
+double WingLineCache::hitRate() const {
+    const auto total = m_hits + m_misses;
+    return total ? double(m_hits) / double(total) : 0.0;
+}
+
+void WingLineCache::resetStats() {
+    m_hits = 0;
+    m_misses = 0;
+}
@@ -0,0 +1,77 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGLINECACHE_H
+#define WINGLINECACHE_H
+
+#include "winghighlightworker.h"
+
+#include <QCache>
+
+struct WingLineCacheKey {
+    size_t textHash;
+    qsizetype length;
+    int stateId;
+};
+
+inline bool operator==(const WingLineCacheKey &lhs,
+                       const WingLineCacheKey &rhs) {
+    return lhs.textHash == rhs.textHash && lhs.length == rhs.length &&
+           lhs.stateId == rhs.stateId;
+}
+
+inline size_t qHash(const WingLineCacheKey &key, size_t seed = 0) {
+    return qHashMulti(seed, key.textHash, key.length, key.stateId);
+}
+
+struct WingLineCacheEntry {
+    /** compared on lookup, the key only holds a hash of it */
+    QString text;
+    QList<WingFormatRun> runs;
+    QList<KSyntaxHighlighting::FoldingRegion> foldingRegions;
+    int stateId;
+};
+
+/**
+ * Least recently used cache of highlighted lines, keyed by the line text
+ * and the interned state the line was highlighted from.
+ */
+class WingLineCache {
+public:
+    explicit WingLineCache(int lines = 4096);
+
+public:
+    /** Returns the cached line for @p key and @p text or nullptr. The
+     *  entry stays valid until the next insert().
+     */
+    const WingLineCacheEntry *find(const WingLineCacheKey &key,
+                                   const QString &text);
+    void insert(const WingLineCacheKey &key, WingLineCacheEntry entry);
+    void clear();
+
+    void setCapacity(int lines);
+    int capacity() const;
+
+    /** Ratio of find() calls that hit, since the last resetStats() */
+    double hitRate() const;
+    void resetStats();
+
+private:
+    QCache<WingLineCacheKey, WingLineCacheEntry> m_cache;
+    qint64 m_hits = 0;
+    qint64 m_misses = 0;
+};
+
+#endif // WINGLINECACHE_H
@@ -79,7 +79,9 @@ void WingLineMargin::paintEvent(QPaintEvent *paintEvent) {
                 bottom >= paintEvent->rect().top()) {
                 const QString lineNum =
                     QString::number(block.blockNumber() + 1);
-                if (block.blockNumber() == cursor.blockNumber())
+                if (m_editor->m_highlighter->isPlainBlock(block))
+                    painter.setPen(m_editor->m_warnFg);
+                else if (block.blockNumber() == cursor.blockNumber())
                     painter.setPen(m_editor->m_cursorLineNum);
                 else
                     painter.setPen(m_editor->m_lineMarginFg);
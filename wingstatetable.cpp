@@ -0,0 +1,47 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#include "wingstatetable.h"
+
+using namespace KSyntaxHighlighting;
+
+WingStateTable::WingStateTable() { clear(); }
+
+int WingStateTable::intern(const State &state) {
+    const auto it = m_ids.constFind(state);
+    if (it != m_ids.constEnd()) {
+        return it.value();
+    }
+
+    const int id = m_states.size();
+    m_states.append(state);
+    m_ids.insert(state, id);
+    return id;
+}
+
+const State &WingStateTable::state(int id) const {
+    if (id <= 0 || id >= m_states.size()) {
+        return m_states.first();
+    }
+    return m_states.at(id);
+}
+
+void WingStateTable::clear() {
+    m_states.clear();
+    m_ids.clear();
+    intern(State());
+}
+
+qsizetype WingStateTable::size() const { return m_states.size(); }
@@ -0,0 +1,47 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+#ifndef WINGSTATETABLE_H
+#define WINGSTATETABLE_H
+
+#include <KSyntaxHighlighting/State>
+
+#include <QHash>
+#include <QList>
+
+/**
+ * Interns highlighting states, so every distinct state is stored once
+ * and two states are equal if and only if their handles are equal.
+ * Handle 0 is always the initial (empty) state.
+ */
+class WingStateTable {
+public:
+    WingStateTable();
+
+public:
+    int intern(const KSyntaxHighlighting::State &state);
+
+    /** Returns the state of @p id, or the empty state for unknown handles */
+    const KSyntaxHighlighting::State &state(int id) const;
+
+    void clear();
+    qsizetype size() const;
+
+private:
+    QList<KSyntaxHighlighting::State> m_states;
+    QHash<KSyntaxHighlighting::State, int> m_ids;
+};
+
+#endif // WINGSTATETABLE_H
@@ -14,6 +14,15 @@
 ****************************************************************************/
 
 #include "wingsyntaxhighlighter.h"
+#include "wingblockmetadata.h"
+#include "wingdirtyranges.h"
+#include "wingfoldindex.h"
+#include "winghighlightbackend.h"
+#include "winghighlightscheduler.h"
+#include "winghighlightworker.h"
+#include "winglinecache.h"
+#include "wingstatetable.h"
+
 #include "abstracthighlighter_p.h"
 #include "definition_p.h"
 #include "format.h"
@@ -21,7 +30,14 @@
 #include "themedata_p.h"
 
 #include <KSyntaxHighlighting/Theme>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QPointer>
 #include <QRegularExpression>
+#include <QSet>
+#include <QSharedPointer>
+#include <QTimer>
 #include <QVector>
 
 Q_DECLARE_METATYPE(QTextBlock)
@@ -30,7 +46,7 @@ using namespace KSyntaxHighlighting;
 
 class WingSyntaxHighlighterPrivate : public AbstractHighlighterPrivate {
 public:
-    static FoldingRegion foldingRegion(const QTextBlock &startBlock);
+    FoldingRegion foldingRegion(const QTextBlock &startBlock) const;
     void initTextFormat(QTextCharFormat &tf, const Format &format);
     void computeTextFormats();
 
@@ -42,20 +58,137 @@ public:
         std::intptr_t ptrId;
     };
 
+    /**
+     * text formats of a definition and its included definitions for one
+     * theme, shared by every highlighter using that pair
+     */
+    struct TextFormatTable {
+        Definition definition;
+        Theme theme;
+        QVector<TextFormat> formats;
+        QTextCharFormat whitespace;
+    };
+
     QList<FoldingRegion> foldingRegions;
-    QVector<TextFormat> tfs;
+    QSharedPointer<const TextFormatTable> tfs;
+    WingStateTable states;
+    WingBlockMetadata blocks;
+    mutable WingFoldIndex foldIndex;
+
+    // indentation-based folding; the ignore list is compiled once per
+    // definition, the folds around blocks whose indentation changed are
+    // closed again before the next lookup
+    QList<QRegularExpression> foldingIgnoreList;
+    mutable WingFoldIndex indentFoldIndex;
+    mutable WingDirtyRanges indentChanges;
+
+    // highlights instead of the definition if one is registered for it;
+    // the block state ids are then its own states, not interned ones
+    QSharedPointer<const WingHighlightBackend> backend;
+    bool backendEnabled = true;
+
+    // memoized lines; the runs of a missed line are collected here and
+    // styled in one pass once the line is highlighted
+    WingLineCache lineCache;
+    QList<WingFormatRun> lineRuns;
+    bool lineCacheable = false;
+
+    // lines beyond these budgets are shown plain
+    int maxLineLength = 20000;
+    int lineTimeBudget = 50;
+    WingPlainLines plainLines;
+
+    // deferred highlighting
+    WingSyntaxHighlighter::HighlightMode highlightMode =
+        WingSyntaxHighlighter::HighlightMode::Synchronous;
+    int asyncThreshold = 512;
+    int syncBudget = 0;
+    int timeSlice = 4;
+    int visibleFirst = 0;
+    int visibleLast = 0;
+    int lookAhead = 100;
+    bool processingSlice = false;
+
+    // blocks waiting to be (re)highlighted, in document order
+    WingDirtyRanges dirty;
+    // blocks whose format runs are still styled with the previous theme
+    WingDirtyRanges stale;
+    bool restyling = false;
+
+    // resume points of a restored editor state
+    QList<int> checkpoints;
+    int rootStateId = -1;
+    int blockCount = 0;
+    QMetaObject::Connection contentsConnection;
+    QPointer<QTextDocument> hookedDocument;
+    bool rehookPending = false;
+    int touchedBlocks = 0;
+    int lastTouchedBlocks = 0;
+
+    QFutureWatcher<WingHighlightBatch> watcher;
+    QTextCursor jobCursor;
+    int jobStateId = 0;
+    int jobRevision = 0;
+    qsizetype jobLines = 0;
+    qsizetype jobApplied = 0;
+    const WingHighlightLine *applyingLine = nullptr;
+
+    bool isDirty(const QTextBlock &block) const {
+        return block.isValid() && dirty.contains(block.blockNumber());
+    }
+
+    bool isPlainLine(const QString &text, size_t textHash) const {
+        return (maxLineLength > 0 && text.size() > maxLineLength) ||
+               plainLines.contains(text, textHash);
+    }
+
+    bool isHighlighted(const QTextBlock &block) const {
+        return block.isValid() && blocks.testFlag(block.blockNumber(),
+                                                  WingBlockMetadata::Highlighted);
+    }
+
+    int blockStateId(const QTextBlock &block) const {
+        return block.isValid() ? blocks.stateId(block.blockNumber()) : 0;
+    }
+
+    const State &blockState(const QTextBlock &block) const {
+        return states.state(blockStateId(block));
+    }
+
+    const WingFoldIndex &folds() const {
+        foldIndex.update(blocks);
+        return foldIndex;
+    }
+
+    void setFoldingRegions(int block, const QList<FoldingRegion> &regions) {
+        if (blocks.setFoldingRegions(block, regions)) {
+            foldIndex.regionsChanged(block);
+        }
+    }
+
+    void setIndent(int block, int indent) {
+        if (blocks.setIndent(block, indent)) {
+            indentChanges.add(block);
+        }
+    }
+
+    void setBlank(int block, bool blank) {
+        if (blocks.setBlank(block, blank)) {
+            indentChanges.add(block);
+        }
+    }
 };
 
-FoldingRegion
-WingSyntaxHighlighterPrivate::foldingRegion(const QTextBlock &startBlock) {
-    const auto data =
-        dynamic_cast<WingTextBlockUserData *>(startBlock.userData());
-    if (!data) {
+FoldingRegion WingSyntaxHighlighterPrivate::foldingRegion(
+    const QTextBlock &startBlock) const {
+    const int blockNumber = startBlock.blockNumber();
+    if (!blocks.testFlag(blockNumber, WingBlockMetadata::FoldBegin)) {
         return FoldingRegion();
     }
-    for (int i = data->foldingRegions.size() - 1; i >= 0; --i) {
-        if (data->foldingRegions.at(i).type() == FoldingRegion::Begin) {
-            return data->foldingRegions.at(i);
+    const auto &regions = blocks.foldingRegions(blockNumber);
+    for (int i = regions.size() - 1; i >= 0; --i) {
+        if (regions.at(i).type() == FoldingRegion::Begin) {
+            return regions.at(i);
         }
     }
     return FoldingRegion();
@@ -84,6 +217,17 @@ void WingSyntaxHighlighterPrivate::initTextFormat(QTextCharFormat &tf,
 }
 
 void WingSyntaxHighlighterPrivate::computeTextFormats() {
+    // the table keeps the definition and the theme alive, so their data
+    // pointers are not reused while the key is in the cache
+    using Key = std::pair<const DefinitionData *, const ThemeData *>;
+    static QHash<Key, QWeakPointer<const TextFormatTable>> tables;
+
+    const Key key(DefinitionData::get(m_definition), ThemeData::get(m_theme));
+    tfs = tables.value(key).toStrongRef();
+    if (tfs) {
+        return;
+    }
+
     auto definitions = m_definition.includedDefinitions();
     definitions.append(m_definition);
 
@@ -94,33 +238,138 @@ void WingSyntaxHighlighterPrivate::computeTextFormats() {
             maxId = qMax(maxId, format.id());
         }
     }
-    tfs.clear();
-    tfs.resize(maxId + 1);
+    auto table = QSharedPointer<TextFormatTable>::create();
+    table->definition = m_definition;
+    table->theme = m_theme;
+    table->formats.resize(maxId + 1);
+    table->whitespace.setForeground(
+        m_theme.editorColor(Theme::TabMarker));
 
     // initialize tfs
     for (const auto &definition : std::as_const(definitions)) {
         for (const auto &format :
              std::as_const(DefinitionData::get(definition)->formats)) {
-            auto &tf = tfs[format.id()];
+            auto &tf = table->formats[format.id()];
             tf.ptrId = FormatPrivate::ptrId(format);
             initTextFormat(tf.tf, format);
         }
     }
+
+    // forget the tables no highlighter uses anymore
+    for (auto it = tables.begin(); it != tables.end();) {
+        it = it.value().isNull() ? tables.erase(it) : std::next(it);
+    }
+    tables.insert(key, table);
+    tfs = table;
 }
 
 WingSyntaxHighlighter::WingSyntaxHighlighter(QObject *parent)
     : QSyntaxHighlighter(parent),
-      AbstractHighlighter(new WingSyntaxHighlighterPrivate) {
+      AbstractHighlighter(new WingSyntaxHighlighterPrivate), m_tabCharSize() {
     qRegisterMetaType<QTextBlock>();
+
+    Q_D(WingSyntaxHighlighter);
+    connect(&d->watcher, &QFutureWatcher<WingHighlightBatch>::resultsReadyAt,
+            this, [this](int begin, int end) {
+                applyHighlightResults(begin, end);
+            });
+    connect(&d->watcher, &QFutureWatcher<WingHighlightBatch>::finished, this,
+            [this]() { scheduleHighlightJob(); });
+    WingHighlightScheduler::instance().registerHighlighter(this);
 }
 
 WingSyntaxHighlighter::WingSyntaxHighlighter(QTextDocument *document)
-    : QSyntaxHighlighter(document),
-      AbstractHighlighter(new WingSyntaxHighlighterPrivate), m_tabCharSize() {
-    qRegisterMetaType<QTextBlock>();
+    : WingSyntaxHighlighter(static_cast<QObject *>(document)) {
+    setDocument(document);
 }
 
-WingSyntaxHighlighter::~WingSyntaxHighlighter() {}
+WingSyntaxHighlighter::~WingSyntaxHighlighter() {
+    Q_D(WingSyntaxHighlighter);
+    WingHighlightScheduler::instance().unregisterHighlighter(this);
+    d->watcher.disconnect(this);
+    d->watcher.future().cancel();
+}
+
+void WingSyntaxHighlighter::resetDocumentState(QTextDocument *doc) {
+    Q_D(WingSyntaxHighlighter);
+    d->watcher.future().cancel();
+    d->dirty.clear();
+    d->stale.clear();
+    d->checkpoints.clear();
+    d->blockCount = doc ? doc->blockCount() : 0;
+    d->blocks.reset(d->blockCount);
+    d->foldIndex.clear();
+    d->indentFoldIndex.clear();
+    d->indentChanges.clear();
+    d->indentChanges.add(0, d->blockCount - 1);
+}
+
+void WingSyntaxHighlighter::hookDocument() {
+    // QSyntaxHighlighter::setDocument() is not virtual, so a document may
+    // arrive without the hook. The block metadata starts over right away,
+    // the document is set again once control is back in the event loop,
+    // to run the hook ahead of QSyntaxHighlighter
+    Q_D(WingSyntaxHighlighter);
+    if (document() == d->hookedDocument || d->rehookPending) {
+        return;
+    }
+    d->rehookPending = true;
+    disconnect(d->contentsConnection);
+    resetDocumentState(document());
+    QMetaObject::invokeMethod(
+        this,
+        [this]() {
+            Q_D(WingSyntaxHighlighter);
+            d->rehookPending = false;
+            if (document() != d->hookedDocument) {
+                setDocument(document());
+            }
+        },
+        Qt::QueuedConnection);
+}
+
+void WingSyntaxHighlighter::setDocument(QTextDocument *doc) {
+    Q_D(WingSyntaxHighlighter);
+
+    disconnect(d->contentsConnection);
+    resetDocumentState(doc);
+    d->hookedDocument = doc;
+
+    // connected ahead of QSyntaxHighlighter, so the block metadata already
+    // follows the new block numbers when the changed blocks are highlighted
+    if (doc) {
+        d->contentsConnection = connect(
+            doc, &QTextDocument::contentsChange, this,
+            [this, d, doc](int from, int charsRemoved, int charsAdded) {
+                Q_UNUSED(charsRemoved);
+                // replaced through QSyntaxHighlighter::setDocument()
+                if (document() != doc) {
+                    return;
+                }
+
+                // the blocks after the first changed one were replaced,
+                // which a net block count delta alone cannot tell
+                const int count = doc->blockCount();
+                const int delta = count - d->blockCount;
+                const int block = doc->findBlock(from).blockNumber();
+                const auto end = doc->findBlock(from + charsAdded);
+                const int last = end.isValid() ? end.blockNumber() : count - 1;
+                const int added = qMax(delta, last - block);
+                const int removed = added - delta;
+                if (added > 0 || removed > 0) {
+                    d->dirty.blocksChanged(block, removed, added);
+                    d->stale.blocksChanged(block, removed, added);
+                    d->blocks.blocksChanged(block, removed, added);
+                    d->foldIndex.blocksChanged(block, removed, added);
+                    d->indentFoldIndex.moveFolds(block, removed, added);
+                    d->indentChanges.blocksChanged(block, removed, added);
+                    d->indentChanges.add(block + 1, block + qMax(added, 1));
+                    d->blockCount = count;
+                }
+            });
+    }
+    QSyntaxHighlighter::setDocument(doc);
+}
 
 void WingSyntaxHighlighter::setDefinition(
     const KSyntaxHighlighting::Definition &def) {
@@ -129,64 +378,115 @@ void WingSyntaxHighlighter::setDefinition(
     const auto needsRehighlight = d->m_definition != def;
     if (DefinitionData::get(d->m_definition) != DefinitionData::get(def)) {
         d->m_definition = def;
-        d->tfs.clear();
+        d->tfs.reset();
+        WingHighlightWorker::loadDefinition(def);
+        resetHighlighting();
     }
     if (needsRehighlight) {
         rehighlight();
     }
 }
 
+void WingSyntaxHighlighter::setBackendEnabled(bool enabled) {
+    Q_D(WingSyntaxHighlighter);
+    if (d->backendEnabled == enabled) {
+        return;
+    }
+    d->backendEnabled = enabled;
+    resetHighlighting();
+    rehighlight();
+}
+
+bool WingSyntaxHighlighter::isBackendEnabled() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->backendEnabled;
+}
+
+QString WingSyntaxHighlighter::backendName() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->backend ? d->backend->name() : QString();
+}
+
+static QList<QRegularExpression> reCompileAll(const QStringList &regexList) {
+    QList<QRegularExpression> compiled;
+    compiled.reserve(regexList.size());
+    for (const QString &expr : regexList)
+        compiled << QRegularExpression(QStringLiteral("^") + expr +
+                                       QStringLiteral("$"));
+    return compiled;
+}
+
+static bool lineEmpty(const QString &text,
+                      const QList<QRegularExpression> &regexList) {
+    if (text.isEmpty())
+        return true;
+
+    return std::any_of(regexList.begin(), regexList.end(),
+                       [text](const QRegularExpression &re) {
+                           const QRegularExpressionMatch m = re.match(text);
+                           return m.hasMatch();
+                       });
+}
+
+void WingSyntaxHighlighter::resetHighlighting() {
+    Q_D(WingSyntaxHighlighter);
+    d->watcher.future().cancel();
+    d->backend = d->backendEnabled
+                     ? WingHighlightBackend::create(d->m_definition)
+                     : nullptr;
+    // the stored handles are meaningless for another definition, and
+    // every block is highlighted again anyway
+    d->states.clear();
+    d->lineCache.clear();
+    d->checkpoints.clear();
+    d->rootStateId = -1;
+    d->plainLines.clear();
+    d->foldingIgnoreList =
+        d->m_definition.indentationBasedFoldingEnabled()
+            ? reCompileAll(d->m_definition.foldingIgnoreList())
+            : QList<QRegularExpression>();
+    d->indentChanges.add(0, d->blockCount - 1);
+}
+
 void WingSyntaxHighlighter::setTheme(const KSyntaxHighlighting::Theme &theme) {
     Q_D(WingSyntaxHighlighter);
     if (ThemeData::get(d->m_theme) != ThemeData::get(theme)) {
         d->m_theme = theme;
-        d->tfs.clear();
+        d->tfs.reset();
+        restyleDocument();
     }
 }
 
 bool WingSyntaxHighlighter::startsFoldingRegion(
     const QTextBlock &startBlock) const {
-    return WingSyntaxHighlighterPrivate::foldingRegion(startBlock).type() ==
-           FoldingRegion::Begin;
+    Q_D(const WingSyntaxHighlighter);
+    return d->foldingRegion(startBlock).type() == FoldingRegion::Begin;
 }
 
 QTextBlock WingSyntaxHighlighter::findFoldingRegionEnd(
     const QTextBlock &startBlock) const {
-    const auto region = WingSyntaxHighlighterPrivate::foldingRegion(startBlock);
+    Q_D(const WingSyntaxHighlighter);
+    if (!startBlock.isValid()) {
+        return QTextBlock();
+    }
+    const int end = d->folds().foldEnd(startBlock.blockNumber());
+    return end < 0 ? QTextBlock() : startBlock.document()->findBlockByNumber(end);
+}
 
-    auto block = startBlock;
-    int depth = 1;
-    while (block.isValid()) {
-        block = block.next();
-        const auto data =
-            dynamic_cast<WingTextBlockUserData *>(block.userData());
-        if (!data) {
-            continue;
-        }
-        for (const auto &foldingRegion : std::as_const(data->foldingRegions)) {
-            if (foldingRegion.id() != region.id()) {
-                continue;
-            }
-            if (foldingRegion.type() == FoldingRegion::End) {
-                --depth;
-            } else if (foldingRegion.type() == FoldingRegion::Begin) {
-                ++depth;
-            }
-            if (depth == 0) {
-                return block;
+void WingSyntaxHighlighter::setTabWidth(int width) {
+    Q_D(WingSyntaxHighlighter);
+    if (m_tabCharSize != width) {
+        m_tabCharSize = width;
+        if (auto doc = document()) {
+            for (auto block = doc->begin(); block.isValid();
+                 block = block.next()) {
+                d->setIndent(block.blockNumber(),
+                             leadingIndentation(block.text()));
             }
         }
     }
-
-    return QTextBlock();
-}
-
-WingTextBlockUserData *WingSyntaxHighlighter::createTextBlockUserData() {
-    return new WingTextBlockUserData;
 }
 
-void WingSyntaxHighlighter::setTabWidth(int width) { m_tabCharSize = width; }
-
 int WingSyntaxHighlighter::tabWidth() const { return m_tabCharSize; }
 
 void WingSyntaxHighlighter::hideBlock(QTextBlock block, bool hide) {
@@ -201,12 +501,46 @@ bool WingSyntaxHighlighter::isFolded(const QTextBlock &block) {
 
 bool WingSyntaxHighlighter::foldContains(const QTextBlock &foldBlock,
                                          const QTextBlock &targetBlock) const {
+    Q_D(const WingSyntaxHighlighter);
+    if (startsFoldingRegion(foldBlock))
+        return d->folds().contains(foldBlock.blockNumber(),
+                                   targetBlock.blockNumber());
     if (!isFoldable(foldBlock))
         return false;
     return (targetBlock.position() >= foldBlock.position()) &&
            (findFoldEnd(foldBlock).position() >= targetBlock.position());
 }
 
+QList<QTextBlock>
+WingSyntaxHighlighter::enclosingFolds(const QTextBlock &block) const {
+    Q_D(const WingSyntaxHighlighter);
+    QList<QTextBlock> folds;
+    if (!block.isValid()) {
+        return folds;
+    }
+
+    const auto doc = block.document();
+    auto begins = d->folds().enclosingFolds(block.blockNumber());
+
+    // a block starting a folding region folds that instead of its
+    // indentation
+    if (definition().indentationBasedFoldingEnabled()) {
+        updateIndentationFolds();
+        const auto indentBegins =
+            d->indentFoldIndex.enclosingFolds(block.blockNumber());
+        for (const auto begin : indentBegins) {
+            if (!startsFoldingRegion(doc->findBlockByNumber(begin))) {
+                begins.append(begin);
+            }
+        }
+        std::sort(begins.begin(), begins.end());
+    }
+    for (const auto begin : std::as_const(begins)) {
+        folds.append(doc->findBlockByNumber(begin));
+    }
+    return folds;
+}
+
 void WingSyntaxHighlighter::foldBlock(QTextBlock block) const {
     block.setUserState(1);
 
@@ -242,6 +576,193 @@ void WingSyntaxHighlighter::unfoldBlock(QTextBlock block) const {
         hideBlock(block, false);
 }
 
+QList<WingSyntaxHighlighter::FoldRange>
+WingSyntaxHighlighter::foldRanges() const {
+    Q_D(const WingSyntaxHighlighter);
+    const auto doc = document();
+    if (!doc) {
+        return {};
+    }
+
+    // the end of the fold starting at each block as findFoldEnd() sees
+    // it, -1 if it is unterminated
+    constexpr int NoFold = -2;
+    const int count = doc->blockCount();
+    QList<int> ends(count, NoFold);
+    for (const auto &fold : d->folds().folds()) {
+        if (fold.begin < count) {
+            ends[fold.begin] = qMin(fold.end, count - 1);
+        }
+    }
+
+    if (definition().indentationBasedFoldingEnabled()) {
+        updateIndentationFolds();
+        for (const auto &fold : d->indentFoldIndex.folds()) {
+            if (fold.begin < count && ends.at(fold.begin) == NoFold) {
+                ends[fold.begin] = qMin(fold.end, count - 1);
+            }
+        }
+    }
+
+    QList<FoldRange> ranges;
+    QList<int> enclosing;
+    for (int begin = 0; begin < count; ++begin) {
+        const int end = ends.at(begin);
+        if (end == NoFold) {
+            continue;
+        }
+        // the last block stays visible if it starts the next fold
+        int last = count - 1;
+        if (end >= 0) {
+            last = ends.at(end) == NoFold ? end : end - 1;
+        }
+        while (!enclosing.isEmpty() && enclosing.last() < begin) {
+            enclosing.removeLast();
+        }
+        ranges.append({begin, last, int(enclosing.size())});
+        enclosing.append(last);
+    }
+    return ranges;
+}
+
+void WingSyntaxHighlighter::applyFoldStates(
+    const QList<FoldRange> &ranges,
+    const std::function<bool(const FoldRange &, bool)> &folded) const {
+    const auto doc = document();
+    if (!doc) {
+        return;
+    }
+
+    // one sweep: a block is hidden while it lies in any folded range
+    auto range = ranges.cbegin();
+    int hiddenUntil = -1;
+    for (auto block = doc->begin(); block.isValid(); block = block.next()) {
+        const int blockNumber = block.blockNumber();
+        const bool hidden = blockNumber <= hiddenUntil;
+        if (block.isVisible() == hidden) {
+            hideBlock(block, hidden);
+        }
+        if (range != ranges.cend() && range->begin == blockNumber) {
+            const bool fold = folded(*range, isFolded(block));
+            block.setUserState(fold ? 1 : -1);
+            if (fold) {
+                hiddenUntil = qMax(hiddenUntil, range->last);
+            }
+            ++range;
+        }
+    }
+}
+
+void WingSyntaxHighlighter::foldToLevel(int level) const {
+    applyFoldStates(foldRanges(), [level](const FoldRange &range, bool) {
+        return range.depth >= level;
+    });
+}
+
+void WingSyntaxHighlighter::unfoldToLevel(int level) const {
+    applyFoldStates(foldRanges(),
+                    [level](const FoldRange &range, bool folded) {
+                        return folded && range.depth >= level;
+                    });
+}
+
+void WingSyntaxHighlighter::setFoldStates(
+    const QList<QPair<int, bool>> &changes) const {
+    if (changes.isEmpty()) {
+        return;
+    }
+    QHash<int, bool> states;
+    states.reserve(changes.size());
+    for (const auto &change : changes) {
+        states.insert(change.first, change.second);
+    }
+    applyFoldStates(foldRanges(),
+                    [&states](const FoldRange &range, bool folded) {
+                        return states.value(range.begin, folded);
+                    });
+}
+
+void WingSyntaxHighlighter::setFoldedRanges(
+    const QList<QPair<int, int>> &ranges) const {
+    const auto doc = document();
+    if (!doc) {
+        return;
+    }
+
+    auto sorted = ranges;
+    std::sort(sorted.begin(), sorted.end());
+    auto range = sorted.cbegin();
+    int hiddenUntil = -1;
+    for (auto block = doc->begin(); block.isValid(); block = block.next()) {
+        const int blockNumber = block.blockNumber();
+        const bool hidden = blockNumber <= hiddenUntil;
+        if (block.isVisible() == hidden) {
+            hideBlock(block, hidden);
+        }
+        while (range != sorted.cend() && range->first < blockNumber) {
+            ++range;
+        }
+        bool folded = false;
+        for (; range != sorted.cend() && range->first == blockNumber;
+             ++range) {
+            folded = true;
+            hiddenUntil = qMax(hiddenUntil, range->second);
+        }
+        if (folded != isFolded(block)) {
+            block.setUserState(folded ? 1 : -1);
+        }
+    }
+}
+
+void WingSyntaxHighlighter::revealBlock(const QTextBlock &block) const {
+    if (!block.isValid() || block.isVisible()) {
+        return;
+    }
+
+    // the run of hidden blocks around block and the fold start above it
+    auto first = block.previous();
+    while (first.isValid() && !first.isVisible()) {
+        first = first.previous();
+    }
+    auto last = block;
+    while (last.next().isValid() && !last.next().isVisible()) {
+        last = last.next();
+    }
+
+    // the last block a fold hides, unknown for a restored fold the
+    // highlighting has not found yet
+    const auto foldLast = [this](const QTextBlock &begin) {
+        const auto end = findFoldEnd(begin);
+        if (!end.isValid()) {
+            return -1;
+        }
+        return isFoldable(end) ? end.blockNumber() - 1 : end.blockNumber();
+    };
+
+    const int target = block.blockNumber();
+    const int firstNumber = first.isValid() ? first.blockNumber() : -1;
+    const int lastNumber = last.blockNumber();
+    int hiddenUntil = -1;
+    auto b = first.isValid() ? first : block.document()->begin();
+    for (; b.isValid() && b.blockNumber() <= lastNumber; b = b.next()) {
+        const int blockNumber = b.blockNumber();
+        const bool shown =
+            blockNumber == firstNumber || blockNumber > hiddenUntil;
+        if (blockNumber != firstNumber && b.isVisible() != shown) {
+            hideBlock(b, !shown);
+        }
+        if (!shown || !isFolded(b)) {
+            continue;
+        }
+        const int foldEnd = foldLast(b);
+        if (blockNumber <= target && (foldEnd < 0 || foldEnd >= target)) {
+            b.setUserState(-1);
+        } else {
+            hiddenUntil = qMax(hiddenUntil, foldEnd < 0 ? lastNumber : foldEnd);
+        }
+    }
+}
+
 int WingSyntaxHighlighter::leadingIndentation(const QString &blockText,
                                               int *indentPos) const {
     int leadingIndent = 0;
@@ -262,42 +783,138 @@ int WingSyntaxHighlighter::leadingIndentation(const QString &blockText,
     return leadingIndent;
 }
 
-static QList<QRegularExpression> reCompileAll(const QStringList &regexList) {
-    QList<QRegularExpression> compiled;
-    compiled.reserve(regexList.size());
-    for (const QString &expr : regexList)
-        compiled << QRegularExpression(QStringLiteral("^") + expr +
-                                       QStringLiteral("$"));
-    return compiled;
+int WingSyntaxHighlighter::blockIndentation(const QTextBlock &block) const {
+    Q_D(const WingSyntaxHighlighter);
+    const int indent = d->blocks.indent(block.blockNumber());
+    return indent >= 0 ? indent : leadingIndentation(block.text());
 }
 
-static bool lineEmpty(const QString &text,
-                      const QList<QRegularExpression> &regexList) {
-    if (text.isEmpty())
-        return true;
+bool WingSyntaxHighlighter::isBlankBlock(const QTextBlock &block) const {
+    Q_D(const WingSyntaxHighlighter);
+    const int blockNumber = block.blockNumber();
+    if (d->blocks.indent(blockNumber) >= 0) {
+        return d->blocks.isBlank(blockNumber);
+    }
+    // not seen by highlightBlock() yet
+    return lineEmpty(block.text(), d->foldingIgnoreList);
+}
 
-    return std::any_of(regexList.begin(), regexList.end(),
-                       [text](const QRegularExpression &re) {
-                           const QRegularExpressionMatch m = re.match(text);
-                           return m.hasMatch();
-                       });
+void WingSyntaxHighlighter::updateIndentationFolds() const {
+    Q_D(const WingSyntaxHighlighter);
+    auto &changes = d->indentChanges;
+    auto &folds = d->indentFoldIndex;
+    const auto doc = document();
+    if (!doc) {
+        changes.clear();
+        return;
+    }
+
+    // an indentation fold ends at the last non-blank block before the
+    // next one indented no deeper. From each changed block on, the folds
+    // still open there are closed again along with the following ones,
+    // until the open blocks are the ones the previous folds left open.
+    struct Open {
+        int block;
+        int indent;
+    };
+    const int count = doc->blockCount();
+    while (!changes.isEmpty()) {
+        const int first = qMin(changes.first(), count);
+        auto previous = doc->findBlockByNumber(first - 1);
+        while (previous.isValid() && isBlankBlock(previous)) {
+            previous = previous.previous();
+        }
+
+        QList<Open> open;
+        int lastNonBlank = -1;
+        if (previous.isValid()) {
+            lastNonBlank = previous.blockNumber();
+            for (const int begin : folds.enclosingFolds(lastNonBlank)) {
+                open.append(
+                    {begin, blockIndentation(doc->findBlockByNumber(begin))});
+            }
+            open.append({lastNonBlank, blockIndentation(previous)});
+        }
+
+        // the previous folds stay in the index until the scan stops
+        QHash<int, int> ends;
+        const auto close = [&](const Open &begin) {
+            ends.insert(begin.block,
+                        lastNonBlank > begin.block ? lastNonBlank : -1);
+        };
+        const auto converged = [&]() {
+            const auto enclosing = folds.enclosingFolds(lastNonBlank);
+            if (enclosing.size() != open.size() - 1) {
+                return false;
+            }
+            for (qsizetype i = 0; i < enclosing.size(); ++i) {
+                if (enclosing.at(i) != open.at(i).block ||
+                    changes.contains(open.at(i).block)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        int last = first - 1;
+        auto block = doc->findBlockByNumber(first);
+        for (; block.isValid(); block = block.next()) {
+            const int blockNumber = block.blockNumber();
+            const bool changed = changes.contains(blockNumber);
+            if (changed) {
+                last = blockNumber;
+            }
+            if (isBlankBlock(block)) {
+                if (changed) {
+                    ends.insert(blockNumber, -1);
+                }
+                continue;
+            }
+            if (!changed && lastNonBlank > last && converged()) {
+                break;
+            }
+
+            const int indent = blockIndentation(block);
+            while (!open.isEmpty() && open.last().indent >= indent) {
+                close(open.takeLast());
+            }
+            open.append({blockNumber, indent});
+            lastNonBlank = blockNumber;
+        }
+
+        if (block.isValid()) {
+            changes.remove(first, block.blockNumber() - 1);
+        } else {
+            while (!open.isEmpty()) {
+                close(open.takeLast());
+            }
+            changes.remove(first, std::numeric_limits<int>::max());
+        }
+        for (auto it = ends.cbegin(); it != ends.cend(); ++it) {
+            if (folds.foldEnd(it.key()) != it.value()) {
+                folds.setFoldEnd(it.key(), it.value());
+            }
+        }
+    }
+}
+
+int WingSyntaxHighlighter::indentationFoldEnd(const QTextBlock &block) const {
+    Q_D(const WingSyntaxHighlighter);
+    updateIndentationFolds();
+    return d->indentFoldIndex.foldEnd(block.blockNumber());
 }
 
 bool WingSyntaxHighlighter::isFoldable(const QTextBlock &block) const {
     if (startsFoldingRegion(block))
         return true;
-    if (definition().indentationBasedFoldingEnabled()) {
-        const auto emptyList = reCompileAll(definition().foldingIgnoreList());
-        if (lineEmpty(block.text(), emptyList))
-            return false;
-
-        const int curIndent = leadingIndentation(block.text());
-        QTextBlock nextBlock = block.next();
-        while (nextBlock.isValid() && lineEmpty(nextBlock.text(), emptyList))
-            nextBlock = nextBlock.next();
-        if (nextBlock.isValid() &&
-            leadingIndentation(nextBlock.text()) > curIndent)
-            return true;
+    if (!definition().indentationBasedFoldingEnabled() || isBlankBlock(block))
+        return false;
+
+    // foldable if the next non-blank block is indented deeper
+    const int indent = blockIndentation(block);
+    for (auto next = block.next(); next.isValid(); next = next.next()) {
+        if (!isBlankBlock(next))
+            return blockIndentation(next) > indent;
     }
     return false;
 }
@@ -308,110 +925,652 @@ WingSyntaxHighlighter::findFoldEnd(const QTextBlock &startBlock) const {
         return findFoldingRegionEnd(startBlock);
 
     if (definition().indentationBasedFoldingEnabled()) {
-        const auto emptyList = reCompileAll(definition().foldingIgnoreList());
+        const int end = indentationFoldEnd(startBlock);
+        return end < 0 ? QTextBlock()
+                       : startBlock.document()->findBlockByNumber(end);
+    }
+    return {};
+}
 
-        const int curIndent = leadingIndentation(startBlock.text());
-        QTextBlock block = startBlock.next();
-        QTextBlock endBlock;
-        for (;;) {
-            while (block.isValid() && lineEmpty(block.text(), emptyList))
-                block = block.next();
-            if (!block.isValid() ||
-                leadingIndentation(block.text()) <= curIndent)
-                break;
-            endBlock = block;
-            block = block.next();
+void WingSyntaxHighlighter::setHighlightMode(HighlightMode mode) {
+    Q_D(WingSyntaxHighlighter);
+    if (d->highlightMode == mode) {
+        return;
+    }
+    d->highlightMode = mode;
+    d->watcher.future().cancel();
+    if (!d->dirty.isEmpty()) {
+        scheduleHighlightJob();
+    }
+}
+
+WingSyntaxHighlighter::HighlightMode
+WingSyntaxHighlighter::highlightMode() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->highlightMode;
+}
+
+void WingSyntaxHighlighter::setAsyncThreshold(int lines) {
+    Q_D(WingSyntaxHighlighter);
+    d->asyncThreshold = qMax(0, lines);
+}
+
+int WingSyntaxHighlighter::asyncThreshold() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->asyncThreshold;
+}
+
+void WingSyntaxHighlighter::setTimeSlice(int msec) {
+    Q_D(WingSyntaxHighlighter);
+    d->timeSlice = qMax(1, msec);
+}
+
+int WingSyntaxHighlighter::timeSlice() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->timeSlice;
+}
+
+void WingSyntaxHighlighter::setVisibleRange(int firstBlock, int lastBlock) {
+    Q_D(WingSyntaxHighlighter);
+    d->visibleFirst = firstBlock;
+    d->visibleLast = lastBlock;
+
+    auto doc = document();
+    if (!doc || (d->dirty.isEmpty() && d->stale.isEmpty())) {
+        return;
+    }
+    if (!d->checkpoints.isEmpty()) {
+        resumeFromCheckpoint(firstBlock);
+    }
+
+    // bring what just scrolled into view to the front of the queue
+    const bool deferred = d->highlightMode != HighlightMode::Synchronous;
+    auto block = doc->findBlockByNumber(firstBlock);
+    const int last = lastBlock + d->lookAhead;
+    for (int n = firstBlock; block.isValid() && n <= last; ++n) {
+        if (deferred && d->dirty.contains(n)) {
+            rehighlightBlock(block);
+        } else if (d->stale.contains(n)) {
+            restyleBlock(block);
         }
-        return endBlock;
+        block = block.next();
     }
-    return {};
+}
+
+void WingSyntaxHighlighter::setLookAhead(int lines) {
+    Q_D(WingSyntaxHighlighter);
+    d->lookAhead = qMax(0, lines);
+}
+
+int WingSyntaxHighlighter::lookAhead() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->lookAhead;
+}
+
+void WingSyntaxHighlighter::setPriority(
+    WingHighlightScheduler::Priority priority) {
+    WingHighlightScheduler::instance().setPriority(this, priority);
+}
+
+WingHighlightScheduler::Priority WingSyntaxHighlighter::priority() const {
+    return WingHighlightScheduler::instance().priority(
+        const_cast<WingSyntaxHighlighter *>(this));
+}
+
+bool WingSyntaxHighlighter::isShown() const {
+    return priority() < WingHighlightScheduler::Priority::Background;
+}
+
+void WingSyntaxHighlighter::setLineCacheSize(int lines) {
+    Q_D(WingSyntaxHighlighter);
+    d->lineCache.setCapacity(qMax(0, lines));
+    d->lineCache.resetStats();
+}
+
+int WingSyntaxHighlighter::lineCacheSize() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->lineCache.capacity();
+}
+
+double WingSyntaxHighlighter::lineCacheHitRate() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->lineCache.hitRate();
+}
+
+void WingSyntaxHighlighter::setMaxLineLength(int chars) {
+    Q_D(WingSyntaxHighlighter);
+    d->maxLineLength = qMax(0, chars);
+}
+
+int WingSyntaxHighlighter::maxLineLength() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->maxLineLength;
+}
+
+void WingSyntaxHighlighter::setLineTimeBudget(int msec) {
+    Q_D(WingSyntaxHighlighter);
+    d->lineTimeBudget = qMax(0, msec);
+}
+
+int WingSyntaxHighlighter::lineTimeBudget() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->lineTimeBudget;
+}
+
+bool WingSyntaxHighlighter::isPlainBlock(const QTextBlock &block) const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->blocks.testFlag(block.blockNumber(), WingBlockMetadata::Plain);
+}
+
+QList<int> WingSyntaxHighlighter::stateCheckpoints(int interval) {
+    Q_D(WingSyntaxHighlighter);
+
+    QList<int> checkpoints;
+    auto doc = document();
+    if (!doc || !d->m_definition.isValid()) {
+        return checkpoints;
+    }
+
+    const int rootId = rootStateId();
+    int next = qMax(1, interval);
+    for (int blockNumber = next; blockNumber < d->blocks.size();
+         ++blockNumber) {
+        if (blockNumber >= next &&
+            d->blocks.testFlag(blockNumber, WingBlockMetadata::Highlighted) &&
+            !d->dirty.contains(blockNumber) &&
+            d->blocks.stateId(blockNumber) == rootId) {
+            checkpoints.append(blockNumber);
+            next = blockNumber + qMax(1, interval);
+        }
+    }
+    return checkpoints;
+}
+
+void WingSyntaxHighlighter::setStateCheckpoints(const QList<int> &blocks) {
+    Q_D(WingSyntaxHighlighter);
+    d->checkpoints = blocks;
+    std::sort(d->checkpoints.begin(), d->checkpoints.end());
+}
+
+int WingSyntaxHighlighter::lastRehighlightCount() const {
+    Q_D(const WingSyntaxHighlighter);
+    return d->lastTouchedBlocks;
 }
 
 void WingSyntaxHighlighter::setSymbolMark(QTextBlock &block,
                                           const QString &id) {
-    auto data = dynamic_cast<WingTextBlockUserData *>(block.userData());
-    if (data) {
-        data->symbolID = id;
-    } else {
-        // first time
-        data = createTextBlockUserData();
-        data->symbolID = id;
-        block.setUserData(data);
-    }
+    Q_D(WingSyntaxHighlighter);
+    d->blocks.setSymbol(block.blockNumber(), id);
 }
 
 QString WingSyntaxHighlighter::symbolMarkID(const QTextBlock &block) {
-    auto data = dynamic_cast<WingTextBlockUserData *>(block.userData());
-    if (data) {
-        return data->symbolID;
-    }
-    return {};
+    Q_D(WingSyntaxHighlighter);
+    return d->blocks.symbol(block.blockNumber());
 }
 
 bool WingSyntaxHighlighter::containsSymbolMark(QTextBlock &block) {
-    auto data = dynamic_cast<WingTextBlockUserData *>(block.userData());
-    if (!data) {
-        return false;
-    }
-    return !data->symbolID.isEmpty();
+    Q_D(WingSyntaxHighlighter);
+    return !d->blocks.symbol(block.blockNumber()).isEmpty();
 }
 
 void WingSyntaxHighlighter::clearSymbolMark(QTextBlock &block) {
-    auto data = dynamic_cast<WingTextBlockUserData *>(block.userData());
-    if (data) {
-        data->symbolID.clear();
-    }
+    Q_D(WingSyntaxHighlighter);
+    d->blocks.setSymbol(block.blockNumber(), QString());
 }
 
 void WingSyntaxHighlighter::highlightBlock(const QString &text) {
     Q_D(WingSyntaxHighlighter);
+    hookDocument();
+
+    // every changed block passes here, even if it is highlighted later
+    const int blockNumber = currentBlock().blockNumber();
+    d->setIndent(blockNumber, leadingIndentation(text));
+    d->setBlank(blockNumber, lineEmpty(text, d->foldingIgnoreList));
+
+    if (d->applyingLine) {
+        applyHighlightLine(*d->applyingLine, text);
+        return;
+    }
 
-    static const State emptyState;
-    const State *previousState = &emptyState;
-    if (currentBlock().position() > 0) {
-        const auto prevBlock = currentBlock().previous();
-        const auto prevData =
-            dynamic_cast<WingTextBlockUserData *>(prevBlock.userData());
-        if (prevData) {
-            previousState = &prevData->state;
+    if (d->restyling) {
+        // a theme change only changes the formats behind the runs
+        const auto flags = d->blocks.flags(blockNumber);
+        if (flags & WingBlockMetadata::Plain) {
+            return;
+        }
+        if ((flags & WingBlockMetadata::Highlighted) &&
+            !(flags & WingBlockMetadata::CustomFormats)) {
+            applyFormatRuns(d->blocks.formatRuns(blockNumber));
+            return;
         }
     }
-    d->foldingRegions.clear();
-    auto newState = highlightLine(text, *previousState);
 
-    auto data = dynamic_cast<WingTextBlockUserData *>(currentBlockUserData());
-    if (!data) {
+    if (d->highlightMode != HighlightMode::Synchronous &&
+        deferHighlightBlock()) {
+        return;
+    }
+
+    const auto block = currentBlock();
+    d->dirty.remove(block.blockNumber());
+    d->stale.remove(block.blockNumber());
+    if (d->touchedBlocks++ == 0) {
+        scheduleHighlightJob();
+    }
+
+    const WingLineCacheKey key{qHash(text), text.size(),
+                               d->blockStateId(block.previous())};
+    const bool plain = d->isPlainLine(text, key.textHash);
+    const WingLineCacheEntry *entry = nullptr;
+    if (!plain && d->lineCache.capacity() > 0) {
+        entry = d->lineCache.find(key, text);
+    }
+
+    auto &blocks = d->blocks;
+    const bool firstTime =
+        !blocks.testFlag(blockNumber, WingBlockMetadata::Highlighted);
+
+    int newStateId;
+    QList<WingFormatRun> formatRuns;
+    bool customFormats = false;
+    if (plain) {
+        // left unformatted. A line turns plain after it was highlighted
+        // once, keeping that end state spares the blocks below a redo.
+        d->foldingRegions.clear();
+        newStateId = firstTime ? key.stateId : blocks.stateId(blockNumber);
+    } else if (entry) {
+        applyFormatRuns(entry->runs);
+        d->foldingRegions = entry->foldingRegions;
+        formatRuns = entry->runs;
+        newStateId = entry->stateId;
+    } else {
+        d->foldingRegions.clear();
+        d->lineRuns.clear();
+        d->lineCacheable = true;
+        QElapsedTimer timer;
+        timer.start();
+        if (d->backend) {
+            newStateId = d->backend->highlightLine(
+                text, key.stateId, d->lineRuns, d->foldingRegions);
+        } else {
+            QMutexLocker locker(
+                &WingHighlightWorker::definitionLock(d->m_definition));
+            newStateId = d->states.intern(
+                highlightLine(text, d->states.state(key.stateId)));
+        }
+        if (d->lineTimeBudget > 0 && timer.elapsed() > d->lineTimeBudget) {
+            d->plainLines.insert(text, key.textHash);
+        }
+        WingHighlightWorker::compactRuns(d->lineRuns, text);
+        applyFormatRuns(d->lineRuns);
+        customFormats = !d->lineCacheable;
+        if (d->lineCacheable && d->lineCache.capacity() > 0) {
+            d->lineCache.insert(
+                key, {text, d->lineRuns, d->foldingRegions, newStateId});
+        }
+        formatRuns = std::exchange(d->lineRuns, {});
+    }
+
+    blocks.setFormatRuns(blockNumber, formatRuns);
+    blocks.setFlag(blockNumber, WingBlockMetadata::CustomFormats,
+                   customFormats);
+    blocks.setFlag(blockNumber, WingBlockMetadata::Plain, plain);
+    if (firstTime) {
         // first time we highlight this
-        data = createTextBlockUserData();
-        data->state = std::move(newState);
-        data->foldingRegions = d->foldingRegions;
-        setCurrentBlockUserData(data);
+        blocks.setFlag(blockNumber, WingBlockMetadata::Highlighted);
+        blocks.setStateId(blockNumber, newStateId);
+        d->setFoldingRegions(blockNumber, d->foldingRegions);
         return;
     }
 
-    if (data->state == newState && data->foldingRegions == d->foldingRegions) {
+    if (blocks.stateId(blockNumber) == newStateId &&
+        blocks.foldingRegions(blockNumber) == d->foldingRegions) {
         // we ended up in the same state, so we are done here
         return;
     }
-    data->state = std::move(newState);
-    data->foldingRegions = d->foldingRegions;
+    const bool stateChanged = blocks.stateId(blockNumber) != newStateId;
+    blocks.setStateId(blockNumber, newStateId);
+    d->setFoldingRegions(blockNumber, d->foldingRegions);
+
+    // the following blocks are redone in batches until their states
+    // converge again
+    const auto nextBlock = block.next();
+    if (stateChanged && nextBlock.isValid()) {
+        d->dirty.add(nextBlock.blockNumber());
+        scheduleHighlightJob();
+    }
+}
+
+bool WingSyntaxHighlighter::deferHighlightBlock() {
+    Q_D(WingSyntaxHighlighter);
 
-    const auto nextBlock = currentBlock().next();
-    if (nextBlock.isValid()) {
-        QMetaObject::invokeMethod(this, "rehighlightBlock",
-                                  Qt::QueuedConnection,
-                                  Q_ARG(QTextBlock, nextBlock));
+    if (d->processingSlice || !d->m_definition.isValid()) {
+        return false;
     }
 
-    static const QRegularExpression ws_regex(QStringLiteral("\\s+"));
-    auto iter = ws_regex.globalMatch(text);
-    QTextCharFormat ws_format;
-    const QBrush ws_brush(
-        theme().editorColor(KSyntaxHighlighting::Theme::TabMarker));
-    ws_format.setForeground(ws_brush);
-    while (iter.hasNext()) {
-        const auto match = iter.next();
-        setFormat(match.capturedStart(), match.capturedLength(), ws_format);
+    // nothing is highlighted right away for a hidden editor
+    const auto block = currentBlock();
+    const int blockNumber = block.blockNumber();
+    if (!isShown()) {
+        d->dirty.add(blockNumber);
+        scheduleHighlightJob();
+        return true;
+    }
+
+    // the viewport is highlighted right away, from the best known state;
+    // it is done again when the blocks above change that state
+    if (blockNumber >= d->visibleFirst &&
+        blockNumber <= d->visibleLast + d->lookAhead) {
+        return false;
+    }
+
+    // the incoming state is unknown until the worker gets here
+    if (d->highlightMode == HighlightMode::Background &&
+        !d->isDirty(block.previous()) && d->syncBudget < d->asyncThreshold) {
+        if (d->syncBudget++ == 0) {
+            QTimer::singleShot(0, this, [d]() { d->syncBudget = 0; });
+        }
+        return false;
+    }
+
+    d->dirty.add(blockNumber);
+    scheduleHighlightJob();
+    return true;
+}
+
+void WingSyntaxHighlighter::applyHighlightLine(const WingHighlightLine &line,
+                                               const QString &text) {
+    Q_D(WingSyntaxHighlighter);
+
+    if (!line.plain) {
+        applyFormatRuns(line.runs);
+    }
+
+    const auto block = currentBlock();
+    const int blockNumber = block.blockNumber();
+    d->dirty.remove(blockNumber);
+    d->stale.remove(blockNumber);
+    ++d->touchedBlocks;
+
+    auto &blocks = d->blocks;
+    const int stateId =
+        d->backend ? line.stateId : d->states.intern(line.state);
+    const bool stateChanged = blocks.stateId(blockNumber) != stateId;
+    blocks.setFlag(blockNumber, WingBlockMetadata::Highlighted);
+    blocks.setStateId(blockNumber, stateId);
+    d->setFoldingRegions(blockNumber, line.foldingRegions);
+    blocks.setFormatRuns(blockNumber, line.runs);
+    blocks.setFlag(blockNumber, WingBlockMetadata::CustomFormats, false);
+    blocks.setFlag(blockNumber, WingBlockMetadata::Plain, line.plain);
+
+    if (!line.plain && d->lineCache.capacity() > 0) {
+        d->lineCache.insert(
+            {line.textHash, text.size(), d->blockStateId(block.previous())},
+            {text, line.runs, line.foldingRegions, stateId});
+    }
+
+    // the snapshot ended before the highlighting converged
+    const auto nextBlock = block.next();
+    if (stateChanged && d->jobApplied + 1 == d->jobLines &&
+        nextBlock.isValid()) {
+        d->dirty.add(nextBlock.blockNumber());
+    }
+}
+
+void WingSyntaxHighlighter::applyFormatRuns(const QList<WingFormatRun> &runs) {
+    Q_D(WingSyntaxHighlighter);
+
+    if (Q_UNLIKELY(!d->tfs)) {
+        d->computeTextFormats();
+    }
+    const auto &tfs = d->tfs->formats;
+    for (const auto &run : runs) {
+        if (run.formatId == WingFormatRun::WhitespaceFormat) {
+            QSyntaxHighlighter::setFormat(run.offset, run.length,
+                                          d->tfs->whitespace);
+            continue;
+        }
+        const auto id = static_cast<std::size_t>(run.formatId);
+        if (id < tfs.size()) {
+            QSyntaxHighlighter::setFormat(run.offset, run.length, tfs[id].tf);
+        }
+    }
+}
+
+int WingSyntaxHighlighter::rootStateId() {
+    Q_D(WingSyntaxHighlighter);
+    if (d->rootStateId < 0 && d->backend) {
+        QList<WingFormatRun> runs;
+        QList<FoldingRegion> regions;
+        d->rootStateId = d->backend->highlightLine({}, 0, runs, regions);
+    } else if (d->rootStateId < 0) {
+        // an empty line highlighted from the initial state leaves the
+        // definition in its root context
+        QMutexLocker locker(
+            &WingHighlightWorker::definitionLock(d->m_definition));
+        d->rootStateId = d->states.intern(highlightLine(QString(), State()));
+        d->foldingRegions.clear();
+    }
+    return d->rootStateId;
+}
+
+void WingSyntaxHighlighter::resumeFromCheckpoint(int blockNumber) {
+    Q_D(WingSyntaxHighlighter);
+
+    // nothing to do if the incoming state is known already
+    auto doc = document();
+    const auto previous = doc->findBlockByNumber(blockNumber - 1);
+    if (!previous.isValid() ||
+        (d->isHighlighted(previous) && !d->isDirty(previous))) {
+        return;
+    }
+
+    constexpr int maxResumeLines = 4096;
+    const auto it = std::upper_bound(d->checkpoints.cbegin(),
+                                     d->checkpoints.cend(), blockNumber - 1);
+    if (it == d->checkpoints.cbegin() ||
+        blockNumber - *std::prev(it) > maxResumeLines) {
+        return;
+    }
+
+    // the checkpoint stays dirty, so the guess is verified once the blocks
+    // above are highlighted and corrected from there if it was wrong
+    auto block = doc->findBlockByNumber(*std::prev(it));
+    if (!d->isHighlighted(block) || d->isDirty(block)) {
+        const int checkpoint = block.blockNumber();
+        d->blocks.setFlag(checkpoint, WingBlockMetadata::Highlighted);
+        d->blocks.setStateId(checkpoint, rootStateId());
+        d->dirty.add(checkpoint);
+    }
+
+    d->processingSlice = true;
+    for (block = block.next(); block.isValid() && block != previous.next();
+         block = block.next()) {
+        rehighlightBlock(block);
+    }
+    d->processingSlice = false;
+}
+
+void WingSyntaxHighlighter::restyleDocument() {
+    Q_D(WingSyntaxHighlighter);
+
+    auto doc = document();
+    if (!doc) {
+        return;
+    }
+
+    // the tokens do not depend on the theme, so the stored runs are only
+    // styled again: the viewport right away, the rest in time slices
+    d->stale.add(0, doc->blockCount() - 1);
+    if (!isShown()) {
+        scheduleHighlightJob();
+        return;
+    }
+    auto block = doc->findBlockByNumber(d->visibleFirst);
+    const int last = d->visibleLast + d->lookAhead;
+    for (int n = d->visibleFirst; block.isValid() && n <= last; ++n) {
+        restyleBlock(block);
+        block = block.next();
+    }
+    scheduleHighlightJob();
+}
+
+void WingSyntaxHighlighter::restyleBlock(const QTextBlock &block) {
+    Q_D(WingSyntaxHighlighter);
+    d->stale.remove(block.blockNumber());
+    d->restyling = true;
+    rehighlightBlock(block);
+    d->restyling = false;
+}
+
+void WingSyntaxHighlighter::scheduleHighlightJob() {
+    WingHighlightScheduler::instance().schedule(this);
+}
+
+void WingSyntaxHighlighter::processScheduledWork() {
+    Q_D(WingSyntaxHighlighter);
+    hookDocument();
+    if (d->highlightMode == HighlightMode::Background &&
+        d->dirty.count() > d->asyncThreshold) {
+        startHighlightJob();
+    } else {
+        processHighlightSlice();
+    }
+
+    if (d->dirty.isEmpty() && d->stale.isEmpty() && !d->watcher.isRunning() &&
+        d->touchedBlocks > 0) {
+        d->lastTouchedBlocks = d->touchedBlocks;
+        d->touchedBlocks = 0;
+        // every block is highlighted for real now
+        d->checkpoints.clear();
+        emit blocksRehighlighted(d->lastTouchedBlocks);
+    }
+}
+
+void WingSyntaxHighlighter::startHighlightJob() {
+    Q_D(WingSyntaxHighlighter);
+
+    // a running job reschedules itself when it is finished
+    auto doc = document();
+    if (!doc || d->watcher.isRunning() || d->dirty.isEmpty()) {
+        return;
+    }
+
+    int blockNumber = d->dirty.first();
+    const auto block = doc->findBlockByNumber(blockNumber);
+    if (!block.isValid()) {
+        d->dirty.clear();
+        return;
+    }
+
+    // make sure nothing is loaded lazily while the worker is running
+    WingHighlightWorker::loadDefinition(d->m_definition);
+    d->ensureDefinitionLoaded();
+
+    // snapshot the dirty blocks plus a tail to detect convergence
+    constexpr qsizetype tailLines = 4096;
+    WingHighlightJob job;
+    job.definition = d->m_definition;
+    job.backend = d->backend;
+    job.state = d->blockState(block.previous());
+    job.stateId = d->backend ? d->blockStateId(block.previous()) : 0;
+    job.maxLineLength = d->maxLineLength;
+    job.plainLines = d->plainLines;
+    qsizetype tail = 0;
+    for (auto b = block; b.isValid() && tail < tailLines;
+         b = b.next(), ++blockNumber) {
+        const bool highlighted =
+            d->blocks.testFlag(blockNumber, WingBlockMetadata::Highlighted);
+        const bool pending = d->dirty.contains(blockNumber) || !highlighted;
+        job.lines.append({b.text(), d->blockState(b),
+                          d->backend ? d->blockStateId(b) : 0, pending,
+                          highlighted});
+        tail = pending ? 0 : tail + 1;
+    }
+
+    d->jobCursor = QTextCursor(block);
+    d->jobStateId = d->blockStateId(block.previous());
+    d->jobRevision = doc->revision();
+    d->jobLines = job.lines.size();
+    d->jobApplied = 0;
+    d->watcher.setFuture(WingHighlightWorker::run(job));
+}
+
+void WingSyntaxHighlighter::processHighlightSlice() {
+    Q_D(WingSyntaxHighlighter);
+
+    auto doc = document();
+    if (!doc) {
+        return;
+    }
+
+    // blocks are processed in document order, so every block is
+    // highlighted from its final incoming state
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 budget = qint64(d->timeSlice) * 1000000;
+    d->processingSlice = true;
+    while (!d->dirty.isEmpty() && timer.nsecsElapsed() < budget) {
+        const int blockNumber = d->dirty.first();
+        d->dirty.remove(blockNumber);
+        const auto block = doc->findBlockByNumber(blockNumber);
+        if (block.isValid()) {
+            rehighlightBlock(block);
+        }
+    }
+    while (d->dirty.isEmpty() && !d->stale.isEmpty() &&
+           timer.nsecsElapsed() < budget) {
+        const auto block = doc->findBlockByNumber(d->stale.first());
+        if (block.isValid()) {
+            restyleBlock(block);
+        } else {
+            d->stale.clear();
+        }
+    }
+    d->processingSlice = false;
+
+    if (!d->dirty.isEmpty() || !d->stale.isEmpty()) {
+        scheduleHighlightJob();
+    }
+}
+
+void WingSyntaxHighlighter::applyHighlightResults(int begin, int end) {
+    Q_D(WingSyntaxHighlighter);
+
+    auto doc = document();
+    if (!doc || d->watcher.isCanceled()) {
+        return;
+    }
+
+    // results are still valid as long as the blocks they belong to have
+    // neither changed their text nor their incoming state
+    const bool textChanged = doc->revision() != d->jobRevision;
+    for (int i = begin; i < end; ++i) {
+        const auto batch = d->watcher.resultAt(i);
+        for (const auto &line : batch) {
+            const auto block = d->jobCursor.block();
+            if (!block.isValid() ||
+                block.position() != d->jobCursor.position() ||
+                d->blockStateId(block.previous()) != d->jobStateId ||
+                (textChanged && qHash(block.text()) != line.textHash)) {
+                if (block.isValid()) {
+                    d->dirty.add(block.blockNumber());
+                }
+                d->watcher.future().cancel();
+                return;
+            }
+
+            d->applyingLine = &line;
+            rehighlightBlock(block);
+            d->applyingLine = nullptr;
+
+            d->jobStateId = d->blockStateId(block);
+            ++d->jobApplied;
+            const auto next = block.next();
+            if (!next.isValid()) {
+                return;
+            }
+            d->jobCursor.setPosition(next.position());
+        }
     }
 }
 
@@ -423,21 +1582,24 @@ void WingSyntaxHighlighter::applyFormat(
 
     Q_D(WingSyntaxHighlighter);
 
-    if (Q_UNLIKELY(d->tfs.empty())) {
+    if (Q_UNLIKELY(!d->tfs)) {
         d->computeTextFormats();
     }
 
+    const auto &tfs = d->tfs->formats;
     const auto id = static_cast<std::size_t>(format.id());
     // This doesn't happen when format comes from the definition.
     // But as the user can override the function to pass any format, this is a
     // possible scenario.
-    if (id < d->tfs.size() &&
-        d->tfs[id].ptrId == FormatPrivate::ptrId(format)) {
-        QSyntaxHighlighter::setFormat(offset, length, d->tfs[id].tf);
+    if (id < tfs.size() && tfs[id].ptrId == FormatPrivate::ptrId(format)) {
+        // styled together with the other runs once the line is done
+        d->lineRuns.append({offset, length, format.id()});
     } else {
         QTextCharFormat tf;
         d->initTextFormat(tf, format);
         QSyntaxHighlighter::setFormat(offset, length, tf);
+        // only formats of the definition can be replayed from the cache
+        d->lineCacheable = false;
     }
 }
 
@@ -446,20 +1608,5 @@ void WingSyntaxHighlighter::applyFolding(
     Q_UNUSED(offset);
     Q_UNUSED(length);
     Q_D(WingSyntaxHighlighter);
-
-    if (region.type() == FoldingRegion::Begin) {
-        d->foldingRegions.push_back(region);
-    }
-
-    if (region.type() == FoldingRegion::End) {
-        for (int i = d->foldingRegions.size() - 1; i >= 0; --i) {
-            if (d->foldingRegions.at(i).id() != region.id() ||
-                d->foldingRegions.at(i).type() != FoldingRegion::Begin) {
-                continue;
-            }
-            d->foldingRegions.remove(i);
-            return;
-        }
-        d->foldingRegions.push_back(region);
-    }
+    WingHighlightWorker::appendFoldingRegion(d->foldingRegions, region);
 }
@@ -16,23 +16,47 @@
 #ifndef WINGSYNTAXHIGHLIGHTER_H
 #define WINGSYNTAXHIGHLIGHTER_H
 
-#include "wingtextblockuserdata.h"
+#include "winghighlightscheduler.h"
 
 #include <KSyntaxHighlighting/SyntaxHighlighter>
+#include <QTextBlock>
+
+#include <functional>
 
 class WingSyntaxHighlighterPrivate;
+struct WingFormatRun;
+struct WingHighlightLine;
 
 class WingSyntaxHighlighter : public QSyntaxHighlighter,
                               public KSyntaxHighlighting::AbstractHighlighter {
+    Q_OBJECT
 public:
     explicit WingSyntaxHighlighter(QObject *parent = nullptr);
     explicit WingSyntaxHighlighter(QTextDocument *document);
     virtual ~WingSyntaxHighlighter();
 
 public:
+    /** Hides QSyntaxHighlighter::setDocument() so block insertions and
+     *  removals are tracked before the changed blocks are highlighted.
+     *  A document set through QSyntaxHighlighter::setDocument() is
+     *  noticed on its first highlighted block and set again through this
+     *  one, at the cost of highlighting it twice.
+     */
+    void setDocument(QTextDocument *doc);
+
     void setDefinition(const KSyntaxHighlighting::Definition &def) override;
     void setTheme(const KSyntaxHighlighting::Theme &theme) override;
 
+    /** Highlights with the WingHighlightBackend registered for the
+     *  definition, if any, instead of the rule interpreter. Enabled by
+     *  default; disable it to compare both on the same document.
+     */
+    void setBackendEnabled(bool enabled);
+    bool isBackendEnabled() const;
+
+    /** Name of the backend in use, empty for the rule interpreter */
+    QString backendName() const;
+
     /** Returns whether there is a folding region beginning at @p startBlock.
      *  This only considers syntax-based folding regions,
      *  not indention-based ones as e.g. found in Python.
@@ -47,17 +71,13 @@ public:
      *  This returns an invalid block if no folding region end is found,
      *  which typically indicates an unterminated region and thus folding
      *  until the document end.
-     *  This method performs a sequential search starting at @p startBlock
-     *  for the matching folding region end, which is a potentially expensive
-     *  operation.
+     *  The folds are looked up in an interval tree, which is rebuilt in one
+     *  pass after folding regions changed.
      *
      *  @see startsFoldingRegion
      */
     QTextBlock findFoldingRegionEnd(const QTextBlock &startBlock) const;
 
-public:
-    virtual WingTextBlockUserData *createTextBlockUserData();
-
 public:
     void setTabWidth(int width);
     int tabWidth() const;
@@ -69,15 +89,152 @@ public:
     bool foldContains(const QTextBlock &foldBlock,
                       const QTextBlock &targetBlock) const;
 
+    /** Returns the first blocks of the folds that hide @p block when they
+     *  are folded, outermost first.
+     */
+    QList<QTextBlock> enclosingFolds(const QTextBlock &block) const;
+
     void foldBlock(QTextBlock block) const;
     void unfoldBlock(QTextBlock block) const;
 
+    struct FoldRange {
+        int begin;
+        /** last block hidden when folded */
+        int last;
+        /** number of folds enclosing this one */
+        int depth;
+    };
+
+    /** Returns every fold of the document sorted by first block, computed
+     *  in one pass. A block starting a syntax fold never starts an
+     *  indentation-based one, as with findFoldEnd().
+     */
+    QList<FoldRange> foldRanges() const;
+
+    /** Folds every fold nested at least @p level folds deep and unfolds
+     *  the ones above, so @p level levels of structure stay visible.
+     *  Level 0 folds everything.
+     */
+    void foldToLevel(int level) const;
+
+    /** Unfolds every fold nested less than @p level folds deep, the
+     *  deeper ones keep their state.
+     */
+    void unfoldToLevel(int level) const;
+
+    /** Folds (true) or unfolds (false) the folds starting at the given
+     *  blocks and updates the visibility of all blocks in one sweep.
+     *  Blocks starting no fold are ignored.
+     */
+    void setFoldStates(const QList<QPair<int, bool>> &changes) const;
+
+    /** Folds exactly the given ranges of a saved fold set, each from its
+     *  first block to the last block it hides, without looking up any
+     *  fold region. All other blocks are shown and unfolded.
+     */
+    void setFoldedRanges(const QList<QPair<int, int>> &ranges) const;
+
+    /** Unfolds the folds hiding @p block, each over its own range, and
+     *  only touches the hidden blocks around it. Other folds, including
+     *  the ones nested inside, keep their state.
+     */
+    void revealBlock(const QTextBlock &block) const;
+
     int leadingIndentation(const QString &blockText,
                            int *indentPos = nullptr) const;
 
     bool isFoldable(const QTextBlock &block) const;
     QTextBlock findFoldEnd(const QTextBlock &startBlock) const;
 
+    /** Returns the leading indentation of @p block, as computed by
+     *  leadingIndentation() when the block was last highlighted.
+     *  Indentation-based folds are derived from these cached values and
+     *  the blank lines of the definition's folding ignore list.
+     */
+    int blockIndentation(const QTextBlock &block) const;
+
+public:
+    enum class HighlightMode {
+        /** Every block is highlighted inside highlightBlock() right away */
+        Synchronous,
+        /** Blocks beyond the viewport and the first @ref asyncThreshold
+         *  lines of one event loop turn are highlighted on a worker thread */
+        Background,
+        /** Blocks beyond the viewport are highlighted in idle time slices
+         *  of @ref timeSlice milliseconds on the GUI thread */
+        Incremental
+    };
+
+    void setHighlightMode(HighlightMode mode);
+    HighlightMode highlightMode() const;
+
+    void setAsyncThreshold(int lines);
+    int asyncThreshold() const;
+
+    void setTimeSlice(int msec);
+    int timeSlice() const;
+
+    /** Blocks between @p firstBlock and @p lastBlock plus @ref lookAhead
+     *  lines are always highlighted first, starting from the best known
+     *  state if the blocks above are not highlighted yet.
+     */
+    void setVisibleRange(int firstBlock, int lastBlock);
+
+    void setLookAhead(int lines);
+    int lookAhead() const;
+
+    /** Sets how the deferred work of this highlighter is scheduled against
+     *  other highlighters. Nothing is highlighted right away for editors
+     *  that are not shown, not even their viewport.
+     */
+    void setPriority(WingHighlightScheduler::Priority priority);
+    WingHighlightScheduler::Priority priority() const;
+
+    /** Memoizes up to @p lines highlighted lines by their text and
+     *  incoming state, 0 disables the cache.
+     */
+    void setLineCacheSize(int lines);
+    int lineCacheSize() const;
+
+    /** Ratio of lines taken from the line cache instead of highlighted */
+    double lineCacheHitRate() const;
+
+    /** Lines longer than @p chars are not highlighted but shown plain,
+     *  passing their incoming state on unchanged. 0 disables the limit.
+     */
+    void setMaxLineLength(int chars);
+    int maxLineLength() const;
+
+    /** A line taking longer than @p msec to highlight is shown plain the
+     *  next time it is highlighted. 0 disables the budget.
+     */
+    void setLineTimeBudget(int msec);
+    int lineTimeBudget() const;
+
+    /** Returns whether @p block exceeded the line budget */
+    bool isPlainBlock(const QTextBlock &block) const;
+
+    /** Returns blocks ending in the root state of the definition, at
+     *  least @p interval blocks apart. Highlighting can resume at any of
+     *  them without the blocks above.
+     */
+    QList<int> stateCheckpoints(int interval);
+
+    /** Sets resume points taken from stateCheckpoints() of identical text.
+     *  Blocks scrolled into view are highlighted from the nearest one
+     *  above until the blocks above are highlighted for real.
+     */
+    void setStateCheckpoints(const QList<int> &blocks);
+
+    /** Number of blocks highlighted by the last finished rehighlight pass */
+    int lastRehighlightCount() const;
+
+signals:
+    /** Emitted once no block is left to highlight, @p count is the number
+     *  of blocks highlighted since the pass started.
+     */
+    void blocksRehighlighted(int count);
+
 public:
     void setSymbolMark(QTextBlock &block, const QString &id);
     QString symbolMarkID(const QTextBlock &block);
@@ -91,10 +248,37 @@ protected:
     void applyFolding(int offset, int length,
                       KSyntaxHighlighting::FoldingRegion region) override;
 
+private:
+    void resetHighlighting();
+    void resetDocumentState(QTextDocument *doc);
+    void hookDocument();
+    bool deferHighlightBlock();
+    void applyHighlightLine(const WingHighlightLine &line, const QString &text);
+    void applyFormatRuns(const QList<WingFormatRun> &runs);
+    int rootStateId();
+    void resumeFromCheckpoint(int blockNumber);
+    void restyleDocument();
+    void restyleBlock(const QTextBlock &block);
+
+    bool isShown() const;
+    bool isBlankBlock(const QTextBlock &block) const;
+    int indentationFoldEnd(const QTextBlock &block) const;
+    void updateIndentationFolds() const;
+    void applyFoldStates(const QList<FoldRange> &ranges,
+                         const std::function<bool(const FoldRange &, bool)>
+                             &folded) const;
+
+    void scheduleHighlightJob();
+    void processScheduledWork();
+    void startHighlightJob();
+    void processHighlightSlice();
+    void applyHighlightResults(int begin, int end);
+
 private:
     int m_tabCharSize;
 
 private:
+    friend class WingHighlightScheduler;
     Q_DECLARE_PRIVATE_D(AbstractHighlighter::d_ptr, WingSyntaxHighlighter)
 };
 
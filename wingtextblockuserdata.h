@@ -1,30 +0,0 @@
-/****************************************************************************
-**
-** Copyright (C) 2025-2028 WingSummer
-**
-** This file may be used under the terms of the GNU General Public License
-** version 3 as published by the Free Software Foundation.
-**
-** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
-** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
-**
-** You should have received a copy of the GNU General Public License version 3
-** along with this program. If not, see <https://www.gnu.org/licenses/>.
-**
-****************************************************************************/
-
-#ifndef WINGTEXTBLOCKUSERDATA_H
-#define WINGTEXTBLOCKUSERDATA_H
-
-#include <KSyntaxHighlighting/FoldingRegion>
-#include <KSyntaxHighlighting/State>
-#include <QTextBlockUserData>
-
-class WingTextBlockUserData : public QTextBlockUserData {
-public:
-    KSyntaxHighlighting::State state;
-    QList<KSyntaxHighlighting::FoldingRegion> foldingRegions;
-    QString symbolID;
-};
-
-#endif // WINGTEXTBLOCKUSERDATA_H
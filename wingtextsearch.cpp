@@ -0,0 +1,458 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#include "wingtextsearch.h"
+
+#include <QPromise>
+#include <QtAlgorithms>
+#include <QScopeGuard>
+#include <QtConcurrent>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                  \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define WING_SEARCH_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+static constexpr auto wordChars = []() {
+    std::array<bool, 128> chars{};
+    for (int c = '0'; c <= '9'; ++c) {
+        chars[c] = true;
+    }
+    for (int c = 'a'; c <= 'z'; ++c) {
+        chars[c] = true;
+        chars[c - 'a' + 'A'] = true;
+    }
+    return chars;
+}();
+
+static bool isWordChar(QChar c) {
+    return c.unicode() < 128 ? wordChars[c.unicode()] : c.isLetterOrNumber();
+}
+
+static char16_t foldCase(char16_t c) {
+    if (c < 128) {
+        return c >= 'A' && c <= 'Z' ? char16_t(c - 'A' + 'a') : c;
+    }
+    return QChar(c).toCaseFolded().unicode();
+}
+
+// the code units folding to the same as @p c, if they are known exactly:
+// only ASCII, and not k and s, which U+212A and U+017F fold to as well
+static bool foldVariants(char16_t c, char16_t variants[2]) {
+    const auto folded = foldCase(c);
+    if (folded >= 128 || folded == 'k' || folded == 's') {
+        return false;
+    }
+    variants[0] = folded;
+    variants[1] = folded >= 'a' && folded <= 'z'
+                      ? char16_t(folded - 'a' + 'A')
+                      : folded;
+    return true;
+}
+
+WingTextSearch::WingTextSearch(const QString &pattern, bool caseSensitive,
+                               bool wholeWord, bool regex, bool multiLine)
+    : m_pattern(pattern), m_caseSensitive(caseSensitive),
+      m_wholeWord(wholeWord), m_isRegex(regex), m_multiLine(regex && multiLine) {
+    if (m_pattern.isEmpty()) {
+        return;
+    }
+    if (m_isRegex) {
+        QRegularExpression::PatternOptions options;
+        if (!m_caseSensitive) {
+            options |= QRegularExpression::CaseInsensitiveOption;
+        }
+        // ^ and $ still match at every line of a snapshot
+        if (m_multiLine) {
+            options |= QRegularExpression::MultilineOption;
+        }
+        m_regex = QRegularExpression(m_pattern, options);
+        m_regex.optimize();
+        return;
+    }
+
+    const auto first = m_pattern.front().unicode();
+    const auto last = m_pattern.back().unicode();
+    if (m_caseSensitive) {
+        m_first[0] = m_first[1] = first;
+        m_last[0] = m_last[1] = last;
+        m_exactFilter = true;
+    } else {
+        m_folded.resize(m_pattern.size());
+        for (qsizetype i = 0; i < m_pattern.size(); ++i) {
+            m_folded[i] = QChar(foldCase(m_pattern.at(i).unicode()));
+        }
+        m_exactFilter =
+            foldVariants(first, m_first) && foldVariants(last, m_last);
+    }
+}
+
+bool WingTextSearch::isEmpty() const {
+    return m_pattern.isEmpty() || (m_isRegex && !m_regex.isValid());
+}
+
+QString WingTextSearch::pattern() const { return m_pattern; }
+
+bool WingTextSearch::caseSensitive() const { return m_caseSensitive; }
+
+bool WingTextSearch::wholeWord() const { return m_wholeWord; }
+
+bool WingTextSearch::isRegex() const { return m_isRegex; }
+
+bool WingTextSearch::isMultiLine() const { return m_multiLine; }
+
+QRegularExpression WingTextSearch::regularExpression() const {
+    return m_regex;
+}
+
+bool WingTextSearch::refines(const WingTextSearch &previous) const {
+    // a whole word match of the previous query is not a substring match
+    if (isEmpty() || previous.isEmpty() || m_isRegex || previous.m_isRegex ||
+        m_multiLine || previous.m_multiLine ||
+        previous.m_wholeWord || m_caseSensitive != previous.m_caseSensitive) {
+        return false;
+    }
+    return m_pattern.contains(previous.m_pattern, m_caseSensitive
+                                                      ? Qt::CaseSensitive
+                                                      : Qt::CaseInsensitive);
+}
+
+void WingTextSearch::matchLine(QStringView line,
+                               QList<Match> &matches) const {
+    Match match;
+    int from = 0;
+    while (findNext(line, from, match)) {
+        if (match.length > 0) {
+            matches.append(match);
+        }
+        from = match.offset + qMax(match.length, 1);
+    }
+}
+
+bool WingTextSearch::findNext(QStringView line, int from,
+                              Match &match) const {
+    if (isEmpty()) {
+        return false;
+    }
+    while (findCandidate(line, from, match)) {
+        if (isWholeWord(line, match.offset, match.length)) {
+            return true;
+        }
+        from = match.offset + 1;
+    }
+    return false;
+}
+
+bool WingTextSearch::findPrevious(QStringView line, int from, Match &match,
+                                  int begin) const {
+    // every match starting up to @p from is visited once
+    bool found = false;
+    Match candidate;
+    int next = begin;
+    while (next <= from && findNext(line, next, candidate) &&
+           candidate.offset <= from) {
+        match = candidate;
+        found = true;
+        next = candidate.offset + 1;
+    }
+    return found;
+}
+
+QRegularExpressionMatch WingTextSearch::regexMatch(const QString &line,
+                                                   const Match &match) const {
+    if (!m_isRegex) {
+        return {};
+    }
+    // the same leftmost match, now over a string the result shares
+    return m_regex.match(line, match.offset, QRegularExpression::NormalMatch,
+                         QRegularExpression::AnchorAtOffsetMatchOption);
+}
+
+bool WingTextSearch::findCandidate(QStringView line, int from,
+                                   Match &match) const {
+    if (!m_isRegex) {
+        const auto offset = findLiteral(line, from);
+        match = {int(offset), int(m_pattern.size())};
+        return offset >= 0;
+    }
+
+    if (from > line.size()) {
+        return false;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(6, 5, 0)
+    const auto result = m_regex.matchView(line, from);
+#else
+    const auto result = m_regex.match(line, from);
+#endif
+    if (!result.hasMatch()) {
+        return false;
+    }
+    match = {int(result.capturedStart()), int(result.capturedLength())};
+    return true;
+}
+
+bool WingTextSearch::literalAt(const char16_t *text) const {
+    const auto size = m_pattern.size();
+    if (m_caseSensitive) {
+        return std::memcmp(text, m_pattern.utf16(), size * sizeof(char16_t)) ==
+               0;
+    }
+    const auto folded = m_folded.utf16();
+    for (qsizetype i = 0; i < size; ++i) {
+        if (foldCase(text[i]) != folded[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+qsizetype WingTextSearch::findLiteral(QStringView line, qsizetype from) const {
+    const auto size = m_pattern.size();
+    const auto last = line.size() - size;
+    const auto text = line.utf16();
+    auto i = qMax<qsizetype>(from, 0);
+    if (i > last) {
+        return -1;
+    }
+
+    // candidates have the first and the last code unit of the pattern in
+    // place, a lane of the mask covers two bits
+    if (m_exactFilter) {
+#if defined(__AVX2__)
+        const auto first0 = _mm256_set1_epi16(short(m_first[0]));
+        const auto first1 = _mm256_set1_epi16(short(m_first[1]));
+        const auto last0 = _mm256_set1_epi16(short(m_last[0]));
+        const auto last1 = _mm256_set1_epi16(short(m_last[1]));
+        for (; i + 15 <= last; i += 16) {
+            const auto head = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(text + i));
+            const auto tail = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(text + i + size - 1));
+            const auto eq = _mm256_and_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi16(head, first0),
+                                _mm256_cmpeq_epi16(head, first1)),
+                _mm256_or_si256(_mm256_cmpeq_epi16(tail, last0),
+                                _mm256_cmpeq_epi16(tail, last1)));
+            auto mask = quint32(_mm256_movemask_epi8(eq));
+            while (mask) {
+                const auto pos = i + qCountTrailingZeroBits(mask) / 2;
+                if (literalAt(text + pos)) {
+                    return pos;
+                }
+                mask &= mask - 1;
+                mask &= mask - 1;
+            }
+        }
+#endif
+#if defined(WING_SEARCH_SSE2)
+        const auto first0 = _mm_set1_epi16(short(m_first[0]));
+        const auto first1 = _mm_set1_epi16(short(m_first[1]));
+        const auto last0 = _mm_set1_epi16(short(m_last[0]));
+        const auto last1 = _mm_set1_epi16(short(m_last[1]));
+        for (; i + 7 <= last; i += 8) {
+            const auto head =
+                _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + i));
+            const auto tail = _mm_loadu_si128(
+                reinterpret_cast<const __m128i *>(text + i + size - 1));
+            const auto eq = _mm_and_si128(
+                _mm_or_si128(_mm_cmpeq_epi16(head, first0),
+                             _mm_cmpeq_epi16(head, first1)),
+                _mm_or_si128(_mm_cmpeq_epi16(tail, last0),
+                             _mm_cmpeq_epi16(tail, last1)));
+            auto mask = quint32(_mm_movemask_epi8(eq));
+            while (mask) {
+                const auto pos = i + qCountTrailingZeroBits(mask) / 2;
+                if (literalAt(text + pos)) {
+                    return pos;
+                }
+                mask &= mask - 1;
+                mask &= mask - 1;
+            }
+        }
+#endif
+        for (; i <= last; ++i) {
+            const auto head = text[i];
+            const auto tail = text[i + size - 1];
+            if ((head == m_first[0] || head == m_first[1]) &&
+                (tail == m_last[0] || tail == m_last[1]) &&
+                literalAt(text + i)) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    for (; i <= last; ++i) {
+        if (literalAt(text + i)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool WingTextSearch::isWholeWord(QStringView line, int offset,
+                                 int length) const {
+    if (!m_wholeWord) {
+        return true;
+    }
+    const int end = offset + length;
+    return (offset == 0 || !isWordChar(line.at(offset - 1))) &&
+           (end == line.size() || !isWordChar(line.at(end)));
+}
+
+struct WingTextSearchChunk {
+    WingTextSearch::Batch matches;
+    int lines = 0;
+};
+
+// lines of text in [begin, end), block numbers relative to the chunk
+static WingTextSearchChunk searchChunk(QPromise<WingTextSearch::Batch> &promise,
+                                       const WingTextSearch &search,
+                                       QStringView text, qsizetype begin,
+                                       qsizetype end) {
+    WingTextSearchChunk chunk;
+    QList<WingTextSearch::Match> matches;
+    auto pos = begin;
+    for (;;) {
+        if (promise.isCanceled()) {
+            return {};
+        }
+        auto lineEnd = text.indexOf(QLatin1Char('\n'), pos);
+        if (lineEnd < 0 || lineEnd > end) {
+            lineEnd = end;
+        }
+        matches.clear();
+        search.matchLine(text.sliced(pos, lineEnd - pos), matches);
+        for (const auto &match : std::as_const(matches)) {
+            chunk.matches.append(
+                {chunk.lines, int(pos) + match.offset, match.length});
+        }
+        ++chunk.lines;
+        if (lineEnd >= end) {
+            return chunk;
+        }
+        pos = lineEnd + 1;
+    }
+}
+
+// matches can span lines, so the text is searched as a whole
+static void searchMultiLine(QPromise<WingTextSearch::Batch> &promise,
+                            const WingTextSearch &search, const QString &text) {
+    WingTextSearch::Batch batch;
+    WingTextSearch::Match match;
+    int blockNumber = 0;
+    int counted = 0;
+    int from = 0;
+    while (search.findNext(text, from, match)) {
+        if (promise.isCanceled()) {
+            return;
+        }
+        blockNumber += int(std::count(text.cbegin() + counted,
+                                      text.cbegin() + match.offset,
+                                      QLatin1Char('\n')));
+        counted = match.offset;
+        if (match.length > 0) {
+            batch.append({blockNumber, match.offset, match.length});
+        }
+        if (batch.size() >= 1024) {
+            promise.addResult(std::move(batch));
+            batch = WingTextSearch::Batch();
+        }
+        from = match.offset + qMax(match.length, 1);
+    }
+    if (!batch.isEmpty()) {
+        promise.addResult(std::move(batch));
+    }
+}
+
+static void searchText(QPromise<WingTextSearch::Batch> &promise,
+                       const WingTextSearch &search, const QString &text) {
+    if (search.isMultiLine()) {
+        searchMultiLine(promise, search, text);
+        return;
+    }
+
+    // chunks end at a line break, the last one at the end of the text
+    QList<QFuture<WingTextSearchChunk>> chunks;
+    const auto waitForChunks = qScopeGuard([&chunks]() {
+        for (auto &chunk : chunks) {
+            chunk.waitForFinished();
+        }
+    });
+    qsizetype begin = 0;
+    for (;;) {
+        auto end = text.size();
+        if (end - begin > WingTextSearch::ChunkSize) {
+            end = text.indexOf(QLatin1Char('\n'),
+                               begin + WingTextSearch::ChunkSize);
+            if (end < 0) {
+                end = text.size();
+            }
+        }
+        chunks.append(
+            QtConcurrent::run([&promise, &search, &text, begin, end]() {
+                return searchChunk(promise, search, text, begin, end);
+            }));
+        if (end >= text.size()) {
+            break;
+        }
+        begin = end + 1;
+    }
+
+    int firstBlock = 0;
+    for (auto &future : chunks) {
+        auto chunk = future.result();
+        if (promise.isCanceled()) {
+            return;
+        }
+        if (!chunk.matches.isEmpty()) {
+            for (auto &match : chunk.matches) {
+                match.blockNumber += firstBlock;
+            }
+            promise.addResult(std::move(chunk.matches));
+        }
+        firstBlock += chunk.lines;
+    }
+}
+
+QFuture<WingTextSearch::Batch> WingTextSearch::run(const QString &text) const {
+    return QtConcurrent::run(searchText, *this, text);
+}
+
+WingTextSearchCache::WingTextSearchCache(int searches) : m_cache(searches) {}
+
+WingTextSearch WingTextSearchCache::search(const QString &pattern,
+                                           bool caseSensitive, bool wholeWord,
+                                           bool regex, bool multiLine) {
+    const Key key{pattern, int(caseSensitive) | int(wholeWord) << 1 |
+                               int(regex) << 2 | int(multiLine) << 3};
+    if (auto search = m_cache.object(key)) {
+        return *search;
+    }
+    auto search = new WingTextSearch(pattern, caseSensitive, wholeWord, regex,
+                                     multiLine);
+    const WingTextSearch result = *search;
+    m_cache.insert(key, search);
+    return result;
+}
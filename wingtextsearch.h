@@ -0,0 +1,158 @@
+/****************************************************************************
+**
+** Copyright (C) 2025-2028 WingSummer
+**
+** This file may be used under the terms of the GNU General Public License
+** version 3 as published by the Free Software Foundation.
+**
+** This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+** WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+**
+** You should have received a copy of the GNU General Public License version 3
+** along with this program. If not, see <https://www.gnu.org/licenses/>.
+**
+****************************************************************************/
+
+
+#ifndef WINGTEXTSEARCH_H
+#define WINGTEXTSEARCH_H
+
+#include <QCache>
+#include <QFuture>
+#include <QList>
+#include <QRegularExpression>
+#include <QString>
+#include <QStringView>
+
+/**
+ * A search query matched against one line at a time, with the semantics
+ * of QTextDocument::find(): matches stay within a line and never overlap.
+ * A zero-width regular expression such as ^, $ or (?=x) finds empty
+ * matches, which findNext() and findPrevious() report and matchLine() and
+ * run() skip. Immutable, so one instance can be shared by threads.
+ * Literal patterns are found by a vectorized scan for their first and
+ * last code units, verified code unit by code unit. A multi-line regular
+ * expression is matched against a whole snapshot instead, so its matches
+ * can span lines.
+ */
+class WingTextSearch {
+public:
+    struct Match {
+        int offset;
+        int length;
+    };
+
+    /** A match in a document snapshot */
+    struct DocumentMatch {
+        int blockNumber;
+        int position;
+        int length;
+    };
+    using Batch = QList<DocumentMatch>;
+
+    /** Snapshots are searched in chunks of about this many characters */
+    static constexpr int ChunkSize = 1 << 20;
+
+    WingTextSearch() = default;
+    WingTextSearch(const QString &pattern, bool caseSensitive, bool wholeWord,
+                   bool regex, bool multiLine = false);
+
+public:
+    /** Returns whether nothing can match, i.e. the pattern is empty or
+     *  not a valid regular expression.
+     */
+    bool isEmpty() const;
+
+    QString pattern() const;
+    bool caseSensitive() const;
+    bool wholeWord() const;
+    bool isRegex() const;
+    bool isMultiLine() const;
+    QRegularExpression regularExpression() const;
+
+    /** Returns whether every line this search matches is also matched by
+     *  @p previous, so only those lines need to be searched again, as
+     *  when a query is typed on.
+     */
+    bool refines(const WingTextSearch &previous) const;
+
+    /** Appends the non-empty matches in @p line to @p matches, in order */
+    void matchLine(QStringView line, QList<Match> &matches) const;
+
+    /** Finds the first match in @p line starting at @p from or after */
+    bool findNext(QStringView line, int from, Match &match) const;
+
+    /** Finds the last match in @p line starting at @p from or before,
+     *  and at @p begin or after.
+     */
+    bool findPrevious(QStringView line, int from, Match &match,
+                      int begin = 0) const;
+
+    /** Returns the regular expression match behind @p match, found in
+     *  @p line. The result keeps a copy of @p line, unlike a match over
+     *  a view, so it stays valid on its own.
+     */
+    QRegularExpressionMatch regexMatch(const QString &line,
+                                       const Match &match) const;
+
+    /** Searches @p text, a QTextDocument::toPlainText() snapshot, on the
+     *  global thread pool, one chunk of whole lines per task. Matches are
+     *  reported in document order, one batch per chunk that has any.
+     *  A multi-line search scans the snapshot as a whole in one task.
+     *  Cancel the future to stop early.
+     */
+    QFuture<Batch> run(const QString &text) const;
+
+private:
+    bool isWholeWord(QStringView line, int offset, int length) const;
+    bool findCandidate(QStringView line, int from, Match &match) const;
+    qsizetype findLiteral(QStringView line, qsizetype from) const;
+    bool literalAt(const char16_t *text) const;
+
+private:
+    QString m_pattern;
+    QRegularExpression m_regex;
+
+    // the pattern case folded unit by unit if case-insensitive, and the
+    // code units a match can begin and end with; without an exact set
+    // of those every position is verified
+    QString m_folded;
+    char16_t m_first[2] = {};
+    char16_t m_last[2] = {};
+    bool m_exactFilter = false;
+
+    bool m_caseSensitive = false;
+    bool m_wholeWord = false;
+    bool m_isRegex = false;
+    bool m_multiLine = false;
+};
+
+/**
+ * The recently used searches of one editor, so a pattern is compiled and
+ * optimized once and not on every search.
+ */
+class WingTextSearchCache {
+public:
+    explicit WingTextSearchCache(int searches = 16);
+
+public:
+    WingTextSearch search(const QString &pattern, bool caseSensitive,
+                          bool wholeWord, bool regex, bool multiLine);
+
+private:
+    struct Key {
+        QString pattern;
+        int options;
+
+        friend bool operator==(const Key &lhs, const Key &rhs) {
+            return lhs.options == rhs.options && lhs.pattern == rhs.pattern;
+        }
+        friend size_t qHash(const Key &key, size_t seed = 0) {
+            return qHashMulti(seed, key.pattern, key.options);
+        }
+    };
+
+    QCache<Key, WingTextSearch> m_cache;
+};
+
+#endif // WINGTEXTSEARCH_H